@@ -0,0 +1,500 @@
+#include "Defines.hpp"
+
+// STL includes
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Boost includes
+
+// Other 3rd-party includes
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif // ifdef HAVE_ZLIB
+
+// Includes specific to this code
+#include "Compress.hpp"
+
+namespace Compress {
+
+   typedef std::vector<char> Bytes;
+
+   // =========================================================================
+   // Filters
+
+   // Byte k of value i goes to k*n + i
+   void shuffle (const std::uint64_t *u, std::size_t n, char *out) {
+      for (std::size_t i = 0; i < n; i++) {
+         std::uint64_t v = u[i];
+         for (unsigned int k = 0; k < 8; k++) {
+            out[k*n + i] = char((v >> (8*k)) & 0xff);
+         }
+      }
+   }
+
+   void unshuffle (const char *in, std::size_t n, std::uint64_t *u) {
+      for (std::size_t i = 0; i < n; i++) {
+         std::uint64_t v = 0;
+         for (unsigned int k = 0; k < 8; k++) {
+            v |= std::uint64_t((unsigned char)in[k*n + i]) << (8*k);
+         }
+         u[i] = v;
+      }
+   }
+
+   // =========================================================================
+   // Quantization (lossy)
+   //    Stored as the error bound, a bitmap of the values stored exactly, and
+   // one 64-bit word per value (shuffled): the step count, zigzag-coded so
+   // that small negative counts are small too, or the value's own bits.
+
+   std::size_t filtered_size (std::size_t n, Filter filter) {
+      if (filter == QUANTIZE) {
+         return sizeof(double) + (n + 7) / 8 + n * sizeof(double);
+      }
+      return n * sizeof(double);
+   }
+
+   // The reconstruction, shared by the writer and the reader so that both
+   // round alike
+   inline double dequantize (double predicted, double step, std::int64_t q) {
+      return predicted + step * double(q);
+   }
+
+   void quantize_values (const double *values, std::size_t n, double bound,
+         char *out) {
+
+      const double step = 2.0 * bound;
+      const double max_steps = 4503599627370496.0;    // 2^52
+      char *bitmap = out + sizeof(double);
+      std::vector<std::uint64_t> u(n);
+      double previous = 0.0;
+
+      std::memcpy(out, &bound, sizeof(double));
+      std::memset(bitmap, 0, (n + 7) / 8);
+      for (std::size_t i = 0; i < n; i++) {
+         const double v = values[i];
+         const double d = (v - previous) / step;
+         // (false for NaNs and infinities too)
+         if (std::fabs(d) < max_steps) {
+            const std::int64_t q = std::llround(d);
+            const double r = dequantize(previous, step, q);
+            if (std::fabs(r - v) <= bound) {
+               u[i] = (std::uint64_t(q) << 1) ^ std::uint64_t(q >> 63);
+               previous = r;
+               continue;
+            }
+         }
+         bitmap[i/8] |= char(1 << (i%8));
+         std::memcpy(&u[i], &v, sizeof(double));
+         previous = v;
+      }
+      shuffle(u.data(), n, bitmap + (n + 7) / 8);
+   }
+
+   void dequantize_values (const char *in, std::size_t n, double *values) {
+
+      double bound;
+      std::memcpy(&bound, in, sizeof(double));
+      if (!(bound > 0.0)) {
+         throw std::runtime_error("corrupt quantized data");
+      }
+      const double step = 2.0 * bound;
+      const char *bitmap = in + sizeof(double);
+      std::vector<std::uint64_t> u(n);
+      double previous = 0.0;
+
+      unshuffle(bitmap + (n + 7) / 8, n, u.data());
+      for (std::size_t i = 0; i < n; i++) {
+         if (bitmap[i/8] & (1 << (i%8))) {
+            std::memcpy(&values[i], &u[i], sizeof(double));
+         } else {
+            const std::int64_t q =
+               std::int64_t(u[i] >> 1) ^ -std::int64_t(u[i] & 1);
+            values[i] = dequantize(previous, step, q);
+         }
+         previous = values[i];
+      }
+   }
+
+   // =========================================================================
+   // Apply and undo a filter
+
+   Bytes apply_filter (const double *values, std::size_t n,
+         const Method &method) {
+      Bytes out(filtered_size(n, method.filter));
+      if (method.filter == QUANTIZE) {
+         quantize_values(values, n, method.bound, out.data());
+         return out;
+      }
+      std::vector<std::uint64_t> u(n);
+      if (n > 0) {
+         std::memcpy(&u[0], values, n * sizeof(double));
+      }
+      switch (method.filter) {
+         case QUANTIZE:
+         case NO_FILTER:
+            if (n > 0) {
+               std::memcpy(&out[0], &u[0], out.size());
+            }
+            break;
+         case XOR_DELTA:
+            for (std::size_t i = n; i-- > 1; ) {
+               u[i] ^= u[i-1];
+            }
+            shuffle(u.data(), n, out.data());
+            break;
+         case SHUFFLE:
+            shuffle(u.data(), n, out.data());
+            break;
+      }
+      return out;
+   }
+
+   void undo_filter (const char *in, std::size_t n, Filter filter,
+         double *values) {
+      std::vector<std::uint64_t> u(n);
+      switch (filter) {
+         case NO_FILTER:
+            if (n > 0) {
+               std::memcpy(&u[0], in, n * sizeof(double));
+            }
+            break;
+         case XOR_DELTA:
+            unshuffle(in, n, u.data());
+            for (std::size_t i = 1; i < n; i++) {
+               u[i] ^= u[i-1];
+            }
+            break;
+         case SHUFFLE:
+            unshuffle(in, n, u.data());
+            break;
+         case QUANTIZE:
+            dequantize_values(in, n, values);
+            return;
+      }
+      if (n > 0) {
+         std::memcpy(values, &u[0], n * sizeof(double));
+      }
+   }
+
+   // =========================================================================
+   // Built-in LZ77 coder
+   //    The output is a series of sequences, each a token byte, a run of
+   // literal bytes, and a match (a 2-byte offset back into the output and a
+   // length).  The token holds the literal count (high 4 bits) and the match
+   // length minus 4 (low 4 bits); a field of 15 continues in the following
+   // bytes, each adding up to 255.  The last sequence has literals only.
+   // Matches are found through a hash of the next 4 bytes; higher levels
+   // follow longer chains of earlier positions with the same hash.
+
+   const std::size_t lz_min_match = 4;
+   const std::size_t lz_window = 65535;
+   const unsigned int lz_hash_bits = 14;
+
+   inline std::uint32_t lz_hash (const unsigned char *p) {
+      std::uint32_t v;
+      std::memcpy(&v, p, sizeof(v));
+      return (v * 2654435761u) >> (32 - lz_hash_bits);
+   }
+
+   void lz_length (Bytes &out, std::size_t extra) {
+      while (extra >= 255) {
+         out.push_back(char(255));
+         extra -= 255;
+      }
+      out.push_back(char(extra));
+   }
+
+   void lz_sequence (Bytes &out, const unsigned char *literals,
+         std::size_t n_lit, std::size_t offset, std::size_t length) {
+      const std::size_t m = (length > 0) ? length - lz_min_match : 0;
+      out.push_back(char(((n_lit < 15 ? n_lit : 15) << 4) |
+               (m < 15 ? m : 15)));
+      if (n_lit >= 15) {
+         lz_length(out, n_lit - 15);
+      }
+      out.insert(out.end(), literals, literals + n_lit);
+      if (length > 0) {
+         out.push_back(char(offset & 0xff));
+         out.push_back(char(offset >> 8));
+         if (m >= 15) {
+            lz_length(out, m - 15);
+         }
+      }
+   }
+
+   Bytes lz_compress (const Bytes &in, int level) {
+
+      const unsigned char *p = (const unsigned char *)in.data();
+      const std::size_t n = in.size();
+      const unsigned int max_chain = 1u << ((level > 1 ? level : 1) - 1);
+      std::vector<long> head(1u << lz_hash_bits, -1);
+      std::vector<long> prev(n, -1);
+      std::size_t i = 0, anchor = 0;
+      Bytes out;
+
+      out.reserve(n / 2 + 16);
+      while (i + lz_min_match <= n) {
+         // The longest match among the earlier positions with this hash
+         const std::uint32_t h = lz_hash(p + i);
+         std::size_t best_len = 0, best_off = 0;
+         long cand = head[h];
+         for (unsigned int chain = 0; (cand >= 0) && (chain < max_chain) &&
+               (i - cand <= lz_window); chain++) {
+            std::size_t len = 0;
+            while ((i + len < n) && (p[cand + len] == p[i + len])) {
+               len++;
+            }
+            if (len > best_len) {
+               best_len = len;
+               best_off = i - cand;
+            }
+            cand = prev[cand];
+         }
+         prev[i] = head[h];
+         head[h] = i;
+
+         if (best_len >= lz_min_match) {
+            lz_sequence(out, p + anchor, i - anchor, best_off, best_len);
+            // Remember the positions inside the match too
+            for (std::size_t k = i + 1;
+                  (k < i + best_len) && (k + lz_min_match <= n); k++) {
+               const std::uint32_t hk = lz_hash(p + k);
+               prev[k] = head[hk];
+               head[hk] = k;
+            }
+            i += best_len;
+            anchor = i;
+         } else {
+            i++;
+         }
+      }
+      lz_sequence(out, p + anchor, n - anchor, 0, 0);
+      return out;
+   }
+
+   // Read a continued length field
+   std::size_t lz_read_length (const unsigned char *&ip,
+         const unsigned char *end) {
+      std::size_t extra = 0;
+      unsigned char b;
+      do {
+         if (ip >= end) {
+            throw std::runtime_error("compressed data is cut short");
+         }
+         b = *ip++;
+         extra += b;
+      } while (b == 255);
+      return extra;
+   }
+
+   void lz_decompress (const char *bytes, std::size_t n_bytes, Bytes &out) {
+
+      const unsigned char *ip = (const unsigned char *)bytes;
+      const unsigned char *end = ip + n_bytes;
+      std::size_t op = 0;
+
+      // The data always ends with a sequence of literals only
+      while (true) {
+         if (ip >= end) {
+            throw std::runtime_error("compressed data is cut short");
+         }
+         const unsigned int token = *ip++;
+         std::size_t n_lit = token >> 4;
+         if (n_lit == 15) {
+            n_lit += lz_read_length(ip, end);
+         }
+         if ((std::size_t(end - ip) < n_lit) || (out.size() - op < n_lit)) {
+            throw std::runtime_error("corrupt compressed data");
+         }
+         if (n_lit > 0) {
+            std::memcpy(out.data() + op, ip, n_lit);
+         }
+         ip += n_lit;
+         op += n_lit;
+         if (ip == end) {
+            break;
+         }
+
+         if (end - ip < 2) {
+            throw std::runtime_error("compressed data is cut short");
+         }
+         const std::size_t offset = ip[0] | (std::size_t(ip[1]) << 8);
+         ip += 2;
+         std::size_t length = (token & 15) + lz_min_match;
+         if ((token & 15) == 15) {
+            length += lz_read_length(ip, end);
+         }
+         if ((offset == 0) || (offset > op) || (out.size() - op < length)) {
+            throw std::runtime_error("corrupt compressed data");
+         }
+         // Byte by byte: the match may overlap what it is copying
+         for (std::size_t k = 0; k < length; k++, op++) {
+            out[op] = out[op - offset];
+         }
+      }
+      if (op != out.size()) {
+         throw std::runtime_error("compressed data has the wrong length");
+      }
+   }
+
+   // =========================================================================
+   // Methods
+
+   bool lossy (const Method &method) {
+      return method.filter == QUANTIZE;
+   }
+
+   bool have_zlib () {
+#ifdef HAVE_ZLIB
+      return true;
+#else // ifdef HAVE_ZLIB
+      return false;
+#endif // ifdef HAVE_ZLIB
+   }
+
+   Method from_string (std::string filter, std::string codec, int level) {
+
+      Method method = none;
+
+      if (filter == "none") {
+         method.filter = NO_FILTER;
+      } else if (filter == "shuffle") {
+         method.filter = SHUFFLE;
+      } else if (filter == "xor") {
+         method.filter = XOR_DELTA;
+      } else {
+         throw std::invalid_argument("unknown compression filter \"" +
+               filter + "\" (expected none, shuffle, or xor)");
+      }
+
+      if ((level < 0) || (level > 9)) {
+         throw std::invalid_argument("compression level must be 0 to 9");
+      }
+      method.level = level;
+
+      if (codec == "auto") {
+         codec = have_zlib() ? "zlib" : "lz";
+      }
+      if ((codec == "zlib") && !have_zlib()) {
+         throw std::invalid_argument("this build has no zlib");
+      } else if (codec == "zlib") {
+         method.codec = ZLIB;
+      } else if (codec == "lz") {
+         method.codec = LZ;
+      } else {
+         throw std::invalid_argument("unknown compression coder \"" +
+               codec + "\" (expected auto, zlib, or lz)");
+      }
+      if (level == 0) {
+         method = none;
+      }
+
+      return method;
+   }
+
+   Method quantize (double bound, std::string codec, int level) {
+      if (!(bound > 0.0) || !std::isfinite(bound)) {
+         throw std::invalid_argument("the error bound must be positive");
+      }
+      Method method = from_string("none", codec, level);
+      method.filter = QUANTIZE;
+      method.bound = bound;
+      return method;
+   }
+
+   std::string to_string (const Method &method) {
+      const char *filters[] = {"none", "shuffle", "xor", "quantize"};
+      const char *codecs[] = {"stored", "zlib", "lz"};
+      std::stringstream ss;
+      if ((method.filter == NO_FILTER) && (method.codec == NO_CODEC)) {
+         return "none";
+      }
+      ss << filters[method.filter];
+      if (method.filter == QUANTIZE) {
+         ss << "(" << method.bound << ")";
+      }
+      ss << "+" << codecs[method.codec];
+      if (method.codec != NO_CODEC) {
+         ss << ":" << method.level;
+      }
+      return ss.str();
+   }
+
+   // =========================================================================
+   // Compress and decompress
+
+   std::vector<char> compress (const double *values, std::size_t n,
+         const Method &method) {
+
+      Bytes filtered = apply_filter(values, n, method);
+
+      switch (method.codec) {
+         case NO_CODEC:
+            return filtered;
+         case LZ:
+            return lz_compress(filtered, method.level);
+         case ZLIB:
+#ifdef HAVE_ZLIB
+            {
+               uLongf n_out = compressBound(filtered.size());
+               Bytes out(n_out);
+               if (compress2((Bytef *)out.data(), &n_out,
+                        (const Bytef *)filtered.data(), filtered.size(),
+                        method.level) != Z_OK) {
+                  throw std::runtime_error("zlib could not compress");
+               }
+               out.resize(n_out);
+               return out;
+            }
+#endif // ifdef HAVE_ZLIB
+            break;
+      }
+      throw std::invalid_argument("compression coder not available");
+   }
+
+   void decompress (const char *bytes, std::size_t n_bytes,
+         const Method &method, double *values, std::size_t n) {
+
+      Bytes filtered(filtered_size(n, method.filter));
+
+      switch (method.codec) {
+         case NO_CODEC:
+            if (n_bytes != filtered.size()) {
+               throw std::runtime_error("stored data has the wrong length");
+            }
+            if (n_bytes > 0) {
+               std::memcpy(&filtered[0], bytes, n_bytes);
+            }
+            break;
+         case LZ:
+            lz_decompress(bytes, n_bytes, filtered);
+            break;
+         case ZLIB:
+#ifdef HAVE_ZLIB
+            {
+               uLongf n_out = filtered.size();
+               if ((uncompress((Bytef *)filtered.data(), &n_out,
+                           (const Bytef *)bytes, n_bytes) != Z_OK) ||
+                     (n_out != filtered.size())) {
+                  throw std::runtime_error("corrupt zlib data");
+               }
+            }
+            break;
+#else // ifdef HAVE_ZLIB
+            throw std::runtime_error("data compressed with zlib, which this "
+                  "build does not have");
+#endif // ifdef HAVE_ZLIB
+         default:
+            throw std::runtime_error("unknown compression coder");
+      }
+
+      undo_filter(filtered.data(), n, method.filter, values);
+   }
+
+}
@@ -0,0 +1,85 @@
+#ifndef COMPRESS_HPP
+#define COMPRESS_HPP
+
+#include "Defines.hpp"
+
+// STL includes
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Boost includes
+
+// Includes specific to this code
+
+// ============================================================================
+// Lossless compression of arrays of doubles
+//    An array goes through a filter that rearranges its bytes so that they
+// compress better, then through a coder:
+// - filters: none; shuffle (all the first bytes of the values, then all the
+//   second bytes, and so on, which groups the slowly changing sign and
+//   exponent bytes together); xor (each value XORed with the one before it,
+//   which leaves mostly zero bits in smooth data, then shuffled)
+// - coders: zlib (when built with HAVE_ZLIB) or a small built-in LZ77 coder
+//   (always available)
+// Levels go from 1 (fastest) to 9 (smallest); at level 0 the values are
+// stored as they are.
+// Decompression restores every bit, including NaNs and signed zeros.
+//    The quantize filter is the one exception: it is lossy, for data that
+// only has to be looked at.  Each value is predicted from the one before it
+// (as the reader will have reconstructed it), and the difference is rounded
+// to a whole number of steps of twice the error bound, so the reconstructed
+// value is within the bound of the original.  Every value is checked as it
+// is encoded; one that would miss the bound (or is not finite) is stored
+// exactly instead.  Smooth data turns into small integers, which the coder
+// then squeezes well.
+//    Like Snapshot, this module does not depend on the rest of the code.
+
+namespace Compress {
+
+   enum Filter { NO_FILTER = 0, SHUFFLE = 1, XOR_DELTA = 2, QUANTIZE = 3 };
+
+   enum Codec { NO_CODEC = 0, ZLIB = 1, LZ = 2 };
+
+   struct Method {
+      Filter filter;
+      Codec codec;
+      int level;
+      double bound;     // the absolute error bound (quantize only)
+   };
+
+   // No compression at all
+   const Method none = {NO_FILTER, NO_CODEC, 0, 0.0};
+
+   // Does the method lose information?
+   bool lossy (const Method &method);
+
+   // Is zlib available in this build?
+   bool have_zlib ();
+
+   // A method from its parts' names: filter "none", "shuffle" or "xor"; coder
+   // "zlib", "lz" or "auto" (zlib if available); level 0 to 9 (0 gives none).
+   // Throws if the names are unknown or zlib is asked for but not available.
+   Method from_string (std::string filter, std::string codec, int level);
+
+   // A lossy method keeping every value within bound (> 0) of the original,
+   // with the given coder and level (0 stores the quantized values as they
+   // are)
+   Method quantize (double bound, std::string codec, int level);
+
+   // The method's name, such as "xor+zlib:6" or "quantize(0.001)+lz:6"
+   std::string to_string (const Method &method);
+
+   // Compress n values
+   std::vector<char> compress (const double *values, std::size_t n,
+         const Method &method);
+
+   // Decompress n values from n_bytes bytes; throws if the bytes do not
+   // hold exactly n values compressed with the method (the error bound of
+   // quantized values is read from the bytes, not from the method)
+   void decompress (const char *bytes, std::size_t n_bytes,
+         const Method &method, double *values, std::size_t n);
+
+}
+
+#endif // ifndef COMPRESS_HPP
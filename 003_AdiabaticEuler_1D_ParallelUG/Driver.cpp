@@ -13,10 +13,14 @@
 #include "Defines.hpp"
 
 // STL includes
+#include <chrono>
 #include <cmath>
 #include <iomanip>
 #include <iostream>
+#include <limits>
+#include <stdexcept>
 #include <string>
+#include <vector>
 
 // Boost includes
 #include <boost/filesystem.hpp>
@@ -33,10 +37,16 @@
 #include "InitConds.hpp"
 #include "Log.hpp"
 #include "Parameters.hpp"
+#include "Steering.hpp"
 #include "Support.hpp"
+#include "Threads.hpp"
 
 namespace Driver {
 
+   // Wall-clock timing
+   typedef std::chrono::steady_clock Clock;
+   typedef std::chrono::duration<double> Seconds;
+
    // =========================================================================
    // component-scope variables
 
@@ -64,12 +74,29 @@ namespace Driver {
    // - print every output_dn steps
    double output_dn = 0;
 
+   // The visualization frequency (lossy snapshots; see
+   // Grid::write_visualization), every viz_dt seconds or viz_dn steps
+   double viz_dt = 0.0;
+   unsigned int viz_dn = 0;
+
+   // Checkpoints on a measured schedule (see choose_checkpoint_interval):
+   // the mean time between failures of the machine (0 = none), and the
+   // wall-clock limit of the run (0 = none) with a margin to leave before it,
+   // all in seconds of wall-clock time since the start of the run
+   double checkpoint_mtbf = 0.0;
+   double wall_limit = 0.0;
+   double wall_margin = 0.0;
+   Clock::time_point t_launch;
+
    // The directory to write the output files
    std::string output_dir;
 
    // The directory containing the files for a restart
    std::string restart_dir;
 
+   // Overlap the guard cell exchange with the update of the interior cells
+   DelayedConst<bool> overlap_halo;
+
 #ifdef PARALLEL_MPI
    // The number of processors and the ID of the local processor
    DelayedConst<int> n_procs, proc_ID;
@@ -106,18 +133,28 @@ namespace Driver {
 #ifdef PARALLEL_MPI
       int mpi_return;
       int temp_int;
+      int thread_support;
 #endif // end ifdef PARALLEL_MPI
 
+      // The wall-clock limit counts from here
+      t_launch = Clock::now();
+
       // ----------------------------------------------------------------------
       // MPI
 
 #ifdef PARALLEL_MPI
       // Initialize
-      mpi_return = MPI_Init(&argc, &argv);
+      // --> Only the main thread makes MPI calls (see Threads.hpp)
+      mpi_return = MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED,
+            &thread_support);
       if (mpi_return != MPI_SUCCESS) {
-         std::cerr << "MPI_Init failed" << std::endl;
+         std::cerr << "MPI_Init_thread failed" << std::endl;
          MPI_Abort(MPI_COMM_WORLD, mpi_return);
       }
+      if (thread_support < MPI_THREAD_FUNNELED) {
+         std::cerr << "MPI does not support MPI_THREAD_FUNNELED" << std::endl;
+         MPI_Abort(MPI_COMM_WORLD, 1);
+      }
       // Get the number of processors and the local processor ID
       MPI_Comm_size(MPI_COMM_WORLD, &temp_int);
       n_procs = temp_int;
@@ -171,18 +208,38 @@ namespace Driver {
       // Time between saving output files
       output_dt = Parameters::get_optional<double>("Driver.output_dt", 0.0);
       output_dn = Parameters::get_optional<unsigned int>("Driver.output_dn",0);
+      viz_dt = Parameters::get_optional<double>("Driver.viz_dt", 0.0);
+      viz_dn = Parameters::get_optional<unsigned int>("Driver.viz_dn", 0);
+      // Checkpoints for the failure rate, and before the wall-clock limit
+      checkpoint_mtbf = Parameters::get_optional<double>(
+            "Driver.checkpoint_mtbf", 0.0);
+      wall_limit = Parameters::get_optional<double>("Driver.wall_limit", 0.0);
+      wall_margin = Parameters::get_optional<double>(
+            "Driver.wall_margin", 0.0);
+      if ((checkpoint_mtbf < 0.0) || (wall_limit < 0.0) ||
+            (wall_margin < 0.0)) {
+         throw std::invalid_argument("Driver.checkpoint_mtbf, "
+               "Driver.wall_limit and Driver.wall_margin must not be "
+               "negative");
+      }
 
       // Restart from which directory
       restart_dir = Parameters::get_optional<std::string>(
             "Driver.restart_dir", "");
       // Modify the restart directory name as needed
-      if (!restart_dir.empty()) {
+      // --> It may also name a single file (a shared snapshot)
+      if (!restart_dir.empty() &&
+            !boost::filesystem::is_regular_file(restart_dir)) {
          // Ensure the directory name ends with a slash
          if (*restart_dir.rbegin() != '/') {
             restart_dir.append("/");
          }
       }
 
+      // Overlap the guard cell exchange with computation
+      overlap_halo = Parameters::get_optional<bool>(
+            "Driver.overlap_halo", true);
+
       // Current time
       time = 0.0;
 
@@ -194,6 +251,8 @@ namespace Driver {
 
       // Initialize
       Log::setup();
+Log::flush();
+      Threads::setup();
 Log::flush();
       Grid::setup();
 Log::flush();
@@ -201,6 +260,8 @@ Log::flush();
 Log::flush();
       InitConds::setup();
 Log::flush();
+      Steering::setup();
+Log::flush();
 
       // Print the used parameters
       Parameters::print_used_parameters();
@@ -230,9 +291,11 @@ Log::flush();
 
       // Have all the other sections run their clean-up routines
       // --> Reverse order from setup in case of dependencies
+      Steering::cleanup();
       InitConds::cleanup();
       Hydro::cleanup();
       Grid::cleanup();
+      Threads::cleanup();
       Parameters::cleanup();
       Log::cleanup();   // Special case -- this seals off the Log file, so it
                         //                 needs to finalize last even though
@@ -274,6 +337,148 @@ Log::flush();
       return dt;
    }
 
+   // =========================================================================
+   // Choose the halo depth factor
+   //    With k times the guard cells, the guard cells are exchanged every k
+   // steps, but each step also updates up to n_guard*(k-1) extra cells at
+   // each end, which the neighbors update too.  On average that is n_guard
+   // *(k-1) extra cells per step, so with an exchange latency L and a cost W
+   // per cell update, a step costs about L/k + W*(n_cells + n_guard*(k-1)),
+   // which is smallest for k = sqrt(L / (W*n_guard)).  This measures L with a
+   // few exchanges of n_guard cells with the neighbors, and W by timing the
+   // update arithmetic on n_cells cells.  All processors use the slowest
+   // values, so they agree on k.
+   //
+   // Arguments:
+   // - n_guard: the number of guard cells used by one step
+   // - n_cells: the number of internal cells on this processor
+   // - n_vars: the number of variables
+   //
+   // Returns:
+   // - the halo depth factor k (at least 1, and no more than n_cells/n_guard
+   //   so the neighbors still have enough cells to send)
+   //
+   // Side effects:
+   // - the measurements and the choice are written to the log
+
+   unsigned int choose_halo_depth (unsigned int n_guard, unsigned int n_cells,
+         unsigned int n_vars) {
+
+      // ----------------------------------------------------------------------
+      // Declare variables
+
+      const int n_trials = 100;
+      const int n_reps = 20;
+      const unsigned int n = n_cells * n_vars;
+      std::vector<double> q(n, 1.0), dQ(n+1, 0.0);
+      Clock::time_point t0;
+      double latency = 0.0;
+      double cell_cost;
+      double k_opt;
+      unsigned int k, k_max;
+      unsigned int min_cells = n_cells;
+      std::stringstream ss;
+#ifdef PARALLEL_MPI
+      std::vector<double> send(n_guard*n_vars, 0.0), recv(n_guard*n_vars);
+      double local[2], global[2];
+#endif // end ifdef PARALLEL_MPI
+
+      // ----------------------------------------------------------------------
+      // Measure
+
+#ifdef PARALLEL_MPI
+      // Exchange latency: one message each way with each neighbor, as in a
+      // guard cell exchange (the first trials are not timed)
+      for (int trial = -10; trial < n_trials; trial++) {
+         if (trial == 0) {
+            MPI_Barrier(MPI_COMM_WORLD);
+            t0 = Clock::now();
+         }
+         MPI_Sendrecv(&send[0], send.size(), MPI_DOUBLE, Grid::neigh_hi, 1,
+               &recv[0], recv.size(), MPI_DOUBLE, Grid::neigh_lo, 1,
+               MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+         MPI_Sendrecv(&send[0], send.size(), MPI_DOUBLE, Grid::neigh_lo, 2,
+               &recv[0], recv.size(), MPI_DOUBLE, Grid::neigh_hi, 2,
+               MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+      }
+      latency = Seconds(Clock::now() - t0).count() / n_trials;
+#endif // end ifdef PARALLEL_MPI
+
+      // Cost of updating one cell (all variables), with the same arithmetic
+      // as the Hydro kernels
+      t0 = Clock::now();
+      for (int rep = 0; rep < n_reps; rep++) {
+         for (unsigned int i = 0; i < n; i++) {
+            dQ[i+1] = (0.5 * q[i]) * 1.0e-3;
+         }
+         for (unsigned int i = 0; i < n; i++) {
+            q[i] = (q[i] + dQ[i]) - dQ[i+1];
+         }
+      }
+      cell_cost = Seconds(Clock::now() - t0).count() / (n_reps * n_cells);
+      if (q[n/2] < 0.0) {
+         // Never true; keeps the loops from being optimized away
+         Log::write_single("");
+      }
+
+#ifdef PARALLEL_MPI
+      // Use the slowest processor's values
+      local[0] = latency;
+      local[1] = cell_cost;
+      MPI_Allreduce(local, global, 2, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+      latency = global[0];
+      cell_cost = global[1];
+      MPI_Allreduce(&n_cells, &min_cells, 1, MPI_UNSIGNED, MPI_MIN,
+            MPI_COMM_WORLD);
+#endif // end ifdef PARALLEL_MPI
+
+      // ----------------------------------------------------------------------
+      // Choose
+
+      k_opt = (cell_cost > 0.0) ? sqrt(latency / (cell_cost * n_guard)) : 1.0;
+      k_max = (min_cells / n_guard > 1) ? min_cells / n_guard : 1;
+      k = (k_opt < 1.0) ? 1 : (unsigned int)(k_opt + 0.5);
+      if (k > k_max) {
+         k = k_max;
+      }
+
+      ss << "Halo depth factor: exchange latency " << std::scientific;
+      ss << std::setprecision(3) << latency << " s, cell update ";
+      ss << cell_cost << " s --> k = " << k << std::endl;
+      Log::write_single(ss.str());
+
+      return k;
+   }
+
+   // =========================================================================
+   // Choose the checkpoint interval
+   //    If a checkpoint takes C seconds to write and the machine fails on
+   // average every M seconds, the time lost to writing checkpoints and to
+   // redoing the work since the last one is smallest with a checkpoint every
+   // sqrt(2*C*M) seconds of work (Young).  Daly's higher-order form,
+   //    sqrt(2*C*M) * (1 + sqrt(C/(2*M))/3 + C/(18*M)) - C,
+   // also counts the checkpoints themselves and holds for C up to 2*M; past
+   // that, checkpoints cost more than they save and the interval is M.
+   //
+   // Arguments:
+   // - cost: the time to write a checkpoint (seconds)
+   // - mtbf: the mean time between failures (seconds)
+   //
+   // Returns:
+   // - the time between checkpoints (seconds)
+   //
+   // Side effects:
+   // - none
+
+   double choose_checkpoint_interval (double cost, double mtbf) {
+      if (cost >= 2.0 * mtbf) {
+         return mtbf;
+      }
+      const double ratio = cost / (2.0 * mtbf);
+      return sqrt(2.0 * cost * mtbf) *
+         (1.0 + sqrt(ratio) / 3.0 + ratio / 9.0) - cost;
+   }
+
    // =========================================================================
    // The main evolution loop
    //    This function runs the main evolution loop and performs any important
@@ -296,10 +501,36 @@ Log::flush();
 
       int prev_write_dt, curr_write_dt;
       int prev_write_dn, curr_write_dn;
-      bool do_write;
+      int prev_viz_dt = -1, prev_viz_dn = -1;
+      bool do_write, do_viz;
+      bool exchange;
+      unsigned int n_exchanges = 0;
       std::string outname;
       const unsigned int w = 13;
-      std::stringstream ss;
+      std::stringstream ss, ss_pct;
+      Clock::time_point t_begin, t_interior, t_finish, t_step;
+      double t_hidden, t_exposed, t_wait, t_work;
+      double sum_hidden = 0.0, sum_exposed = 0.0;
+
+      // The checkpoint schedule, planned every plan_dn steps from the
+      // measured cost of the last output and time of a step (negative until
+      // measured): the time and number of steps taken up to the last output,
+      // the step of that output and when it ended, the steps at which to
+      // write the next checkpoint and to stop for the wall-clock limit, and
+      // the checkpoint interval last written to the log
+      bool scheduled;
+      const unsigned int plan_dn = 20;
+      const unsigned int never = std::numeric_limits<unsigned int>::max();
+      unsigned int next_plan = 0;
+      unsigned int last_write = 0, next_checkpoint = never, stop_step = never;
+      unsigned int interval_dn = 0, logged_dn = 0;
+      double write_cost = -1.0, step_time = -1.0;
+      double work_time = 0.0;
+      unsigned int work_steps = 0;
+      Clock::time_point t_write, t_written;
+
+      // Commands from the steering channel (see Steering.hpp)
+      Steering::Commands commands;
 
       // ----------------------------------------------------------------------
       // Initialize
@@ -314,6 +545,24 @@ Log::flush();
       prev_write_dt = -1;
       prev_write_dn = -1;
 
+      scheduled = (checkpoint_mtbf > 0.0) || (wall_limit > 0.0);
+      if (scheduled) {
+         ss << "Checkpoints: ";
+         if (checkpoint_mtbf > 0.0) {
+            ss << "Young/Daly interval for a mean time between failures of ";
+            ss << checkpoint_mtbf << " s";
+         }
+         if (wall_limit > 0.0) {
+            ss << ((checkpoint_mtbf > 0.0) ? "; " : "");
+            ss << "last one before the wall-clock limit of " << wall_limit;
+            ss << " s (margin " << wall_margin << " s)";
+         }
+         ss << std::endl << std::endl;
+         Log::write_single(ss.str());
+      }
+      next_plan = last_write = n_step;
+      t_written = Clock::now();
+
       for (; n_step < max_steps; n_step++) {
 
          // Exceeded maximum time
@@ -321,15 +570,122 @@ Log::flush();
             break;
          }
 
-         // Boundary condition fill
-         Grid::fill_boundary_conditions();
+         // Plan the checkpoints from the slowest processor's measurements:
+         // the cost of the last output, the time of a step (averaged over
+         // the run, not counting the outputs, once there are plan_dn steps),
+         // and the wall-clock time so far
+         if (scheduled && (n_step >= next_plan)) {
+            double measured[3];
+            measured[0] = write_cost;
+            measured[1] = work_time + Seconds(Clock::now() - t_written).count();
+            measured[2] = Seconds(Clock::now() - t_launch).count();
+#ifdef PARALLEL_MPI
+            MPI_Allreduce(MPI_IN_PLACE, measured, 3, MPI_DOUBLE, MPI_MAX,
+                  MPI_COMM_WORLD);
+#endif // end ifdef PARALLEL_MPI
+            if (work_steps + n_step - last_write >= plan_dn) {
+               step_time = measured[1] / (work_steps + n_step - last_write);
+            }
+            if ((step_time > 0.0) && (checkpoint_mtbf > 0.0) &&
+                  (measured[0] >= 0.0)) {
+               const double interval =
+                  choose_checkpoint_interval(measured[0], checkpoint_mtbf);
+               interval_dn = (unsigned int)std::min(
+                     std::max(1.0, floor(interval / step_time + 0.5)),
+                     double(max_steps));
+               next_checkpoint = last_write + interval_dn;
+               // Note the interval when it changes by more than a tenth
+               if (fabs(double(interval_dn) - logged_dn) > 0.1 * logged_dn) {
+                  ss.clear();
+                  ss.str("");
+                  ss << "CHECKPOINT : output " << std::scientific;
+                  ss << std::setprecision(3) << measured[0] << " s, step ";
+                  ss << step_time << " s --> every " << interval_dn;
+                  ss << " steps (" << interval << " s)" << std::endl;
+                  Log::write_single(ss.str());
+                  logged_dn = interval_dn;
+               }
+            }
+            // Stop in time to write a last output (and take one more step)
+            // before the limit
+            if ((step_time > 0.0) && (wall_limit > 0.0)) {
+               const double left = wall_limit - wall_margin - measured[2] -
+                  2.0 * std::max(measured[0], 0.0) - step_time;
+               stop_step = n_step + (unsigned int)std::min(
+                     std::max(0.0, floor(left / step_time)),
+                     double(max_steps));
+            }
+            next_plan = n_step + plan_dn;
+         }
+
+         // Controlled exit before the wall-clock limit (the last output
+         // follows the loop)
+         if (n_step >= stop_step) {
+            Log::write_single("--- WALL-CLOCK LIMIT ---\n");
+            break;
+         }
 
-         // Controlled exit on an alternate condition (not time or steps, but
-         // by an external action by the user)
-         if (boost::filesystem::exists("_force_quit")) {
+         // Commands from the user (every Steering.poll_dn steps)
+         commands = Steering::poll(n_step);
+         if (commands.quit) {
             Log::write_single("--- FORCED EXIT ---\n");
             break;
          }
+         if (commands.output_dn >= 0) {
+            output_dn = commands.output_dn;
+            prev_write_dn = (output_dn > 0) ? int(n_step / output_dn) : -1;
+         }
+         if (commands.output_dt >= 0.0) {
+            output_dt = commands.output_dt;
+            prev_write_dt = (output_dt > 0.0) ? int(floor(time / output_dt)) :
+               -1;
+         }
+         if (commands.report) {
+            // The slowest processor's time since the start, and each
+            // processor's time per step (not counting outputs) and time spent
+            // waiting for guard cells
+            double wall = Seconds(Clock::now() - t_launch).count();
+            const double steps = work_steps + n_step - last_write;
+            const double mean = (steps > 0) ? (work_time +
+                  Seconds(Clock::now() - t_written).count()) / steps : 0.0;
+#ifdef PARALLEL_MPI
+            MPI_Allreduce(MPI_IN_PLACE, &wall, 1, MPI_DOUBLE, MPI_MAX,
+                  MPI_COMM_WORLD);
+#endif // end ifdef PARALLEL_MPI
+            ss.clear();
+            ss.str("");
+            ss << "TIMING : step " << n_step << ", wall-clock time ";
+            ss << std::scientific << std::setprecision(3) << wall << " s, ";
+            ss << "last output " << std::max(write_cost, 0.0) << " s, ";
+            ss << n_exchanges << " guard cell exchanges" << std::endl;
+            Log::write_single(ss.str());
+            ss.clear();
+            ss.str("");
+#ifdef PARALLEL_MPI
+            ss << "Process " << std::setw(p_width) << proc_ID << " : ";
+#endif // end ifdef PARALLEL_MPI
+            ss << std::scientific << std::setprecision(3);
+            ss << mean << " s per step, " << sum_exposed;
+            ss << " s waiting for guard cells" << std::endl;
+            Log::write_all(ss.str());
+            Log::flush();
+         }
+
+         // Boundary condition fill
+         // --> With deep halos (Grid.halo_depth_factor), this is only needed
+         //     when the guard cells have been used up
+         // --> With overlap_halo, the exchange is only started here and is
+         //     finished after the interior cells are updated below
+         exchange = Grid::exchange_due();
+         if (exchange) {
+            n_exchanges++;
+            if (overlap_halo) {
+               t_begin = Clock::now();
+               Grid::begin_boundary_exchange();
+            } else {
+               Grid::fill_boundary_conditions();
+            }
+         }
 
          // Write output
          do_write = false;
@@ -353,15 +709,48 @@ Log::flush();
             }
             prev_write_dn = curr_write_dn;
          }
-         // Do the actual write
+         // Condition based on the checkpoint schedule, or on request
+         if ((n_step >= next_checkpoint) || commands.checkpoint) {
+            do_write = true;
+         }
+         // Do the actual write (timed for the checkpoint schedule)
          if (do_write) {
+            t_write = Clock::now();
+            work_time += Seconds(t_write - t_written).count();
+            work_steps += n_step - last_write;
             outname = Grid::write_data();
+            t_written = Clock::now();
+            write_cost = Seconds(t_written - t_write).count();
+            last_write = n_step;
+            next_checkpoint = (next_checkpoint == never) ? never :
+               n_step + interval_dn;
             ss.clear();
             ss.str("");
-            ss << "OUTPUT : wrote output \"" << outname << "\"" << std::endl;
+            ss << "OUTPUT : ";
+            ss << ((Grid::async_output || Grid::fork_output) ?
+                  "queued" : "wrote");
+            ss << " output \"" << outname << "\"" << std::endl;
             Log::write_single(ss.str());
          }
 
+         // Write visualization output (on its own schedule)
+         do_viz = (time == 0) && ((viz_dt > 0.0) || (viz_dn > 0));
+         if (viz_dt > 0.0) {
+            const int curr_viz_dt = int(floor(time / viz_dt));
+            do_viz = do_viz || (curr_viz_dt > prev_viz_dt);
+            prev_viz_dt = curr_viz_dt;
+         }
+         if (viz_dn > 0) {
+            const int curr_viz_dn = n_step / viz_dn;
+            do_viz = do_viz || (curr_viz_dn > prev_viz_dn);
+            prev_viz_dn = curr_viz_dn;
+         }
+         if (do_viz) {
+            outname = Grid::write_visualization();
+            Log::write_single("OUTPUT : wrote visualization \"" + outname +
+                  "\"\n");
+         }
+
          // Compute step size
          dt = compute_time_step();
 
@@ -371,11 +760,47 @@ Log::flush();
          ss << "n = " << std::setw(n_width) << std::right << n_step;
          ss << "; t = " << std::setw(w) << std::scientific << time;
          ss << "; dt = " << std::setw(w) << std::scientific << dt;
+
+         // Evolve a single step of hydrodynamics
+         // --> The time spent (not counting waiting for the guard cells)
+         //     goes to the load balancing
+         t_step = Clock::now();
+         t_wait = 0.0;
+         if (exchange && overlap_halo && Hydro::tiled) {
+            // The tiles that need the guard cells wait for the exchange; the
+            // step finishes it
+            Hydro::tiled_step(true);
+         } else if (exchange && overlap_halo) {
+            // Update the cells that do not need guard data while the guard
+            // cells are in flight, then finish the exchange and the edges
+            Hydro::interior_step();
+            t_interior = Clock::now();
+            Grid::finish_boundary_exchange();
+            t_finish = Clock::now();
+            Hydro::edge_step();
+            // Overlap efficiency: the fraction of the time between starting
+            // and finishing the exchange that was spent working rather than
+            // waiting for messages
+            t_hidden  = Seconds(t_interior - t_begin).count();
+            t_exposed = Seconds(t_finish - t_interior).count();
+            sum_hidden  += t_hidden;
+            sum_exposed += t_exposed;
+            t_wait = t_exposed;
+            ss_pct.clear();
+            ss_pct.str("");
+            ss_pct << std::fixed << std::setprecision(1) << std::setw(5);
+            ss_pct << 100.0 * t_hidden / (t_hidden + t_exposed);
+            ss << "; overlap = " << ss_pct.str() << "%";
+         } else {
+            Hydro::one_step();
+         }
+         Grid::end_step();
+         t_work = Seconds(Clock::now() - t_step).count() - t_wait;
          ss << std::endl;
          Log::write_single(ss.str());
 
-         // Evolve a single step of hydrodynamics
-         Hydro::one_step();
+         // Rebalance the cells among the processors if needed
+         Grid::balance_load(t_work);
 
          // Update time
          time = time + dt;
@@ -392,8 +817,29 @@ Log::flush();
       outname = Grid::write_data();
       ss.clear();
       ss.str("");
-      ss << "OUTPUT : wrote output \"" << outname << "\"" << std::endl;
+      ss << "OUTPUT : " << ((Grid::async_output || Grid::fork_output) ?
+            "queued" : "wrote");
+      ss << " output \"" << outname << "\"" << std::endl;
+      Log::write_single(ss.str());
+
+      // Summarize the guard cell exchanges
+      ss.clear();
+      ss.str("");
+      ss << std::endl << "Guard cell exchanges: " << n_exchanges << " (every ";
+      ss << Grid::halo_depth << " step" << ((Grid::halo_depth > 1) ? "s" : "");
+      ss << ")" << std::endl;
       Log::write_single(ss.str());
+      if (overlap_halo && (sum_hidden + sum_exposed > 0.0)) {
+         ss.clear();
+         ss.str("");
+         ss << "Guard cell exchange: " << std::scientific;
+         ss << std::setprecision(3) << sum_hidden << " s overlapped, ";
+         ss << sum_exposed << " s waiting (overlap efficiency ";
+         ss << std::fixed << std::setprecision(1);
+         ss << 100.0 * sum_hidden / (sum_hidden + sum_exposed) << "%)";
+         ss << std::endl;
+         Log::write_single(ss.str());
+      }
 
       // ----------------------------------------------------------------------
       // Finalize
@@ -29,6 +29,8 @@ namespace Driver {
    extern std::string output_dir;
    extern std::string restart_dir;
 
+   extern DelayedConst<bool> overlap_halo;
+
 #ifdef PARALLEL_MPI
    extern DelayedConst<int> n_procs, proc_ID;
    extern DelayedConst<unsigned int> p_width;
@@ -49,6 +51,11 @@ namespace Driver {
 
    double compute_time_step();
 
+   // =========================================================================
+   // Choose the halo depth factor from measured latency and compute rate
+   unsigned int choose_halo_depth (unsigned int n_guard, unsigned int n_cells,
+         unsigned int n_vars);
+
    // =========================================================================
    // The main evolution loop
 
@@ -1,12 +1,23 @@
 #include "Defines.hpp"
 
 // STL includes
+#include <algorithm>
+#include <cassert>
+#include <cctype>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
 #include <cmath>
+#include <cstring>
 #include <exception>
 #include <fstream>
+#include <functional>
 #include <iomanip>
 #include <iostream>
+#include <limits>
+#include <memory>
 #include <sstream>
+#include <thread>
 #include <vector>
 
 // Boost includes
@@ -16,8 +27,15 @@
 #ifdef PARALLEL_MPI
 #include "mpi.h"
 #endif // end ifdef PARALLEL_MPI
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 // Includes specific to this code
+#include "Compress.hpp"
 #include "Driver.hpp"
 #include "Grid.hpp"
 #include "GridVars.hpp"
@@ -25,7 +43,10 @@
 #include "InitConds.hpp"
 #include "Log.hpp"
 #include "Parameters.hpp"
+#include "Snapshot.hpp"
 #include "Support.hpp"
+#include "TextFormat.hpp"
+#include "Threads.hpp"
 
 namespace fs = boost::filesystem;
 
@@ -37,6 +58,28 @@ namespace Grid {
    // Number of guard (aka ghost) cells around the borders
    DelayedConst<unsigned int> Ng;
 
+   // Deep halos: the guard cells used up by one step, and the number of steps
+   // between guard cell exchanges (Ng = halo_depth * Ng_step)
+   DelayedConst<unsigned int> Ng_step;
+   DelayedConst<unsigned int> halo_depth;
+
+   // The number of steps taken since the guard cells were last filled
+   unsigned int halo_age;
+
+   // Load balancing: how often to check (in steps; 0 = never), the largest
+   // acceptable ratio of the slowest processor's time to the average, and
+   // the time measured since the last check
+   DelayedConst<unsigned int> balance_interval;
+   DelayedConst<double> balance_threshold;
+   double balance_time = 0.0;
+   unsigned int balance_steps = 0;
+
+   // Over-decomposition for the task scheduler: the internal cells are split
+   // into tiles of tile_cells cells (0 = no tiles), and tile_starts holds the
+   // first cell of every tile but the first
+   DelayedConst<unsigned int> tile_cells;
+   std::vector<int> tile_starts;
+
    // Number of internal (non-guard) cells
    DelayedConst<unsigned int> Nx_global; // globally
    DelayedConst<unsigned int> Nx_local;  // on this processor
@@ -44,296 +87,2638 @@ namespace Grid {
    // Upper and lower limits
    DelayedConst<double> xmin, xmax;
 
-   // Grid spacing
-   DelayedConst<double> dx;
+   // Grid spacing
+   DelayedConst<double> dx;
+
+   // Array of coordinates
+   CellVar x;
+
+   // Data grid
+   CellVar data;
+
+   // Indices of arrays
+   DelayedConst<int> ilo, ihi; // arrays include indices ilo to ihi-1
+
+   // The processor IDs of the lower and upper neighbors
+   DelayedConst<int> neigh_lo, neigh_hi;
+
+   std::vector<std::string> var_list;
+   DelayedConst<unsigned int> n_vars;
+
+   // Reusable per-step workspaces
+   ScratchPool<CellVar> cell_scratch;
+   ScratchPool<FaceVar> face_scratch;
+
+   // Guard cell exchange state
+   bool exchange_active = false;
+#ifdef PARALLEL_MPI
+   // Persistent requests: two receives and two sends (1 up, 1 down)
+   MPI_Request halo_requests[4];
+   // Datatypes describing the four slabs within the grid data
+   MPI_Datatype halo_types[4];
+   bool halo_requests_set = false;
+#endif // ifdef PARALLEL_MPI
+
+   // Memory layout of multi-variable grid data
+   DelayedConst<Layout> layout;
+   DelayedConst<unsigned int> tile_width;
+
+   // Output precision
+   const unsigned int w = TextFormat::width;
+
+   // Output format: a directory of text files (one per processor) for each
+   // output (ascii) or one binary file for each output (shared)
+   std::string output_format;
+
+   // Compression of the arrays of shared snapshots (positions first)
+   std::vector<Compress::Method> snapshot_methods;
+
+   // Visualization snapshots: the error bound of each variable (absolute,
+   // and relative to the variable's range; 0 = unused), and the coder
+   std::vector<double> viz_abs_error, viz_rel_error;
+   std::string viz_coder;
+   DelayedConst<int> viz_level;
+
+   // Delta checkpoints (shared snapshots only): the deltas written between
+   // full snapshots (0 = none), the cells per block, and how far a value
+   // must move for its block to be stored (0 = any change of its bits)
+   DelayedConst<unsigned int> delta_every;
+   DelayedConst<unsigned int> delta_block;
+   DelayedConst<double> delta_tolerance;
+
+   // The chain so far: this processor's internal cells as the last output of
+   // the chain holds them (variable by variable; empty = the next output
+   // starts a new chain), the step of that output and of the chain's
+   // snapshot, the size of that snapshot, and the deltas written since it
+   std::vector<double> delta_reference;
+   unsigned long delta_base_step = 0, delta_full_step = 0;
+   std::size_t delta_full_bytes = 0;
+   unsigned int deltas_written = 0;
+
+   // Write the text output from a background thread
+   DelayedConst<bool> async_output;
+
+   // Write the output from a child process
+   DelayedConst<bool> fork_output;
+
+   // Node-level aggregation of the text output: the processors of each node
+   // are split into aggregators_per_node groups (0 = no aggregation), and
+   // each group gathers its cells to its first processor, which writes one
+   // data file for the group
+   DelayedConst<unsigned int> aggregators_per_node;
+#ifdef PARALLEL_MPI
+   MPI_Comm io_comm = MPI_COMM_NULL;   // this processor's group
+   int io_rank = 0, io_size = 1;       // its place in the group
+   int io_file = 0;                    // the number of the group's file
+   int n_io_files = 0;                 // the number of groups
+#endif // ifdef PARALLEL_MPI
+
+   // Wall-clock timing
+   typedef std::chrono::steady_clock Clock;
+   typedef std::chrono::duration<double> Seconds;
+
+   // =========================================================================
+   // Add a new variable to the Grid
+
+   unsigned int add_variable(std::string new_var) {
+      for (unsigned int i = 0; i < var_list.size(); i++) {
+         if (var_list[i] == new_var) {
+            return i;
+         }
+      }
+      var_list.push_back(new_var);
+      return var_list.size() - 1;
+   }
+
+   // =========================================================================
+   // Convert between a layout and its name in the parameter file
+
+   Layout layout_from_string(std::string name) {
+      for (unsigned int i = 0; i < name.length(); i++) {
+         name[i] = tolower(name[i]);
+      }
+      if (name == "aos") {
+         return AOS;
+      } else if (name == "soa") {
+         return SOA;
+      } else if (name == "aosoa") {
+         return AOSOA;
+      } else {
+         throw std::invalid_argument("unknown grid layout \"" + name + "\"");
+      }
+   }
+
+   std::string layout_to_string(Layout lay) {
+      switch (lay) {
+         case SOA:
+            return "soa";
+         case AOSOA:
+            return "aosoa";
+         default:
+            return "aos";
+      }
+   }
+
+#ifdef PARALLEL_MPI
+   // =========================================================================
+   // Persistent guard cell exchange
+   //    The Ng*n_vars values of each halo slab are sent straight from and
+   // received straight into the grid data, using an MPI datatype that lists
+   // where each value lives.  The values are listed cell by cell (variable by
+   // variable for SOA, so each run is a contiguous array), and runs that are
+   // adjacent in memory are merged: an AOS slab is a single contiguous block,
+   // an SOA slab is one block per variable.  Both neighbors use the same
+   // layout and order, so the values match up even though the slabs sit at
+   // different places in their arrays.  The requests are created once here
+   // and restarted every step, so there is no packing and no per-step setup.
+
+   MPI_Datatype slab_type(int first) {
+      const int ng = Ng;
+      const unsigned int nv = n_vars;
+      std::vector<int> lengths, displs;
+      std::vector<std::size_t> offsets;
+      MPI_Datatype type;
+
+      // Offsets in exchange order
+      if (data.get_layout() == SOA) {
+         for (unsigned int v = 0; v < nv; v++) {
+            for (int i = 0; i < ng; i++) {
+               offsets.push_back(data.offset(first+i, v));
+            }
+         }
+      } else {
+         for (int i = 0; i < ng; i++) {
+            for (unsigned int v = 0; v < nv; v++) {
+               offsets.push_back(data.offset(first+i, v));
+            }
+         }
+      }
+
+      // Merge adjacent offsets into blocks
+      for (std::size_t k = 0; k < offsets.size(); k++) {
+         if ((k > 0) && (offsets[k] == offsets[k-1] + 1)) {
+            lengths.back()++;
+         } else {
+            displs.push_back(offsets[k]);
+            lengths.push_back(1);
+         }
+      }
+
+      MPI_Type_indexed(lengths.size(), &lengths[0], &displs[0], MPI_DOUBLE,
+            &type);
+      MPI_Type_commit(&type);
+      return type;
+   }
+
+   void setup_halo_requests() {
+      int pass_up = 1;
+      int pass_down = 2;
+      double *base = data.storage();
+
+      halo_types[0] = slab_type(ilo);           // lower guard cells
+      halo_types[1] = slab_type(ihi - Ng);      // upper guard cells
+      halo_types[2] = slab_type(ilo + Ng);      // lowest internal cells
+      halo_types[3] = slab_type(ihi - 2*Ng);    // highest internal cells
+
+      MPI_Recv_init(base, 1, halo_types[0], neigh_lo, pass_up,
+            MPI_COMM_WORLD, &halo_requests[0]);
+      MPI_Recv_init(base, 1, halo_types[1], neigh_hi, pass_down,
+            MPI_COMM_WORLD, &halo_requests[1]);
+      MPI_Send_init(base, 1, halo_types[2], neigh_lo, pass_down,
+            MPI_COMM_WORLD, &halo_requests[2]);
+      MPI_Send_init(base, 1, halo_types[3], neigh_hi, pass_up,
+            MPI_COMM_WORLD, &halo_requests[3]);
+      halo_requests_set = true;
+   }
+
+   void free_halo_requests() {
+      if (halo_requests_set) {
+         for (int r = 0; r < 4; r++) {
+            MPI_Request_free(&halo_requests[r]);
+            MPI_Type_free(&halo_types[r]);
+         }
+         halo_requests_set = false;
+      }
+   }
+#endif // ifdef PARALLEL_MPI
+
+   // =========================================================================
+   // Local grid
+   //    Fill the coordinates and find the tiles for the current limits.
+
+   void fill_coordinates () {
+      x.init();
+      for (int i = ilo; i < ihi; i++) {
+         x(i) = xmin + dx * (i + 0.5);
+      }
+   }
+
+   void find_tiles () {
+      tile_starts.clear();
+      if (tile_cells > 0) {
+         for (int i = ilo + Ng + tile_cells; i < ihi - int(Ng);
+               i += tile_cells) {
+            tile_starts.push_back(i);
+         }
+      }
+   }
+
+   // =========================================================================
+   // Text output files
+   //    Each step directory holds a header, one data file per processor (or
+   // per aggregation group), and an index of the cells in each data file
+   // (see read_data).  Whoever writes into a directory creates it (if it is
+   // not there yet), so there is no barrier, and an existing directory is
+   // reused: its files are overwritten, and processor 0 removes the data
+   // files that the index does not list (left by an earlier run on more
+   // processors or with other aggregation), so only the output's own files
+   // remain.
+
+   struct IndexEntry {
+      std::string file;             // the data file
+      unsigned long first, count;   // its cells
+      unsigned long data_offset;    // where its first data line starts
+      unsigned long line_bytes;     // the length of each line (0 = varies)
+   };
+
+   // The name of a processor's data file
+   std::string data_file_name (int proc) {
+#ifdef PARALLEL_MPI
+      std::stringstream ss;
+      ss << "grid_" << std::setfill('0') << std::setw(Driver::p_width);
+      ss << proc << ".dat";
+      return ss.str();
+#else // PARALLEL_MPI
+      return "grid.dat";
+#endif // PARALLEL_MPI
+   }
+
+   // The name of an aggregation group's data file
+   std::string node_file_name (int group) {
+      std::stringstream ss;
+      ss << "node_" << std::setfill('0') << std::setw(6) << group << ".dat";
+      return ss.str();
+   }
+
+   // The bytes before the first data line of a data file
+   std::size_t data_header_bytes () {
+      std::size_t bytes = std::string("# position\n").size();
+      for (unsigned int v = 0; v < n_vars; v++) {
+         bytes += var_list[v].size() + 3;
+      }
+      return bytes;
+   }
+
+   // Write the index of the data files of an output (processor 0 writes it,
+   // with one line for the cells of each processor)
+   // --> Every value takes w characters, so every data line of every file
+   //     has the same length.
+   void write_index (const std::string &dirname) {
+
+      // This processor's cells, its file, and the cells before them in it
+      unsigned long mine[4] = {(unsigned long)(ilo + Ng), Nx_local, 0, 0};
+      std::vector<unsigned long> all(4, 0);
+      const std::size_t line_bytes = w * (n_vars + 1) + 3 * n_vars + 1;
+      std::vector<std::string> files;
+      std::ofstream fout;
+
+#ifdef PARALLEL_MPI
+      mine[2] = (aggregators_per_node > 0) ? io_file : Driver::proc_ID;
+      if (aggregators_per_node > 0) {
+         unsigned long n = Nx_local;
+         MPI_Exscan(&n, &mine[3], 1, MPI_UNSIGNED_LONG, MPI_SUM, io_comm);
+         mine[3] = (io_rank > 0) ? mine[3] : 0;
+      }
+      all.resize(4 * Driver::n_procs);
+      MPI_Gather(mine, 4, MPI_UNSIGNED_LONG, &all[0], 4, MPI_UNSIGNED_LONG,
+            0, MPI_COMM_WORLD);
+      if (Driver::proc_ID != 0) {
+         return;
+      }
+#else // PARALLEL_MPI
+      std::copy(mine, mine + 4, all.begin());
+#endif // PARALLEL_MPI
+
+      fs::create_directories(dirname);
+      fout.open((dirname + "/index.txt").c_str());
+      fout << "# file   first_cell   n_cells   data_offset   line_bytes";
+      fout << std::endl;
+      for (unsigned int r = 0; r < all.size() / 4; r++) {
+         files.push_back((aggregators_per_node > 0) ?
+               node_file_name(all[4*r+2]) : data_file_name(all[4*r+2]));
+         fout << files.back();
+         fout << "   " << all[4*r] << "   " << all[4*r+1] << "   ";
+         fout << data_header_bytes() + all[4*r+3] * line_bytes << "   ";
+         fout << line_bytes << std::endl;
+      }
+      fout.close();
+      if (!fout) {
+         throw std::ios_base::failure("could not write " + dirname +
+               "/index.txt");
+      }
+
+      // Remove the data files of an earlier output that are not in the index
+      for (fs::directory_iterator iter(dirname), end; iter != end; iter++) {
+         const std::string name = iter->path().filename().string();
+         if (((name == "grid.dat") || (name.compare(0, 5, "grid_") == 0) ||
+                  (name.compare(0, 5, "node_") == 0)) &&
+               (iter->path().extension() == ".dat") &&
+               (std::find(files.begin(), files.end(), name) == files.end())) {
+            fs::remove(iter->path());
+         }
+      }
+   }
+
+   // =========================================================================
+   // Background output
+   //    With Grid.async_output, write_data only copies the internal cells
+   // into an output frame and hands the frame to an I/O thread, which formats
+   // and writes it while the evolution goes on.  There are output_buffers
+   // frames (two is double buffering); write_data waits only when every
+   // frame is still being written.  Frames go to the I/O thread and come back
+   // through two lock-free queues.  The I/O thread never calls MPI: with
+   // aggregation, the cells are gathered before the frame is queued.
+   // This applies to the text output; shared snapshots are always written
+   // synchronously, since MPI-IO must be called from the main thread.
+
+   struct OutputFrame {
+      std::string dirname;          // the output directory
+      std::string file;             // the data file
+      bool header;                  // also write the header?
+      double time;
+      unsigned int step;
+      unsigned int n_cells;         // this processor's internal cells
+      std::vector<double> arrays;   // positions, then each variable
+      double t_write;               // time the I/O thread spent on it
+      double t_stalled;             // time write_data waited for it
+      std::string error;            // what went wrong (if anything)
+   };
+
+   // The frames, and the queues of frame numbers to and from the I/O thread
+   // --> Sending n_frames tells the I/O thread to stop.
+   std::vector<OutputFrame> frames;
+   std::unique_ptr< Threads::SpscQueue<unsigned int> > to_writer, from_writer;
+   std::thread writer;
+
+   // Totals for the summary
+   unsigned int n_async = 0;
+   double sum_write = 0.0, sum_stalled = 0.0;
+
+   // Wait between checks of a queue
+   const std::chrono::microseconds io_poll(100);
+
+#ifdef PARALLEL_MPI
+   // Split the processors of each node (those that share memory) into
+   // aggregators_per_node groups of neighboring processors, and number the
+   // groups
+   void setup_aggregation () {
+      MPI_Comm node_comm;
+      int node_rank, node_size, is_first, n_before = 0;
+      MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED,
+            Driver::proc_ID, MPI_INFO_NULL, &node_comm);
+      MPI_Comm_rank(node_comm, &node_rank);
+      MPI_Comm_size(node_comm, &node_size);
+      const int n_groups = std::min<int>(aggregators_per_node, node_size);
+      MPI_Comm_split(node_comm, (long)node_rank * n_groups / node_size,
+            node_rank, &io_comm);
+      MPI_Comm_free(&node_comm);
+      MPI_Comm_rank(io_comm, &io_rank);
+      MPI_Comm_size(io_comm, &io_size);
+      is_first = (io_rank == 0) ? 1 : 0;
+      MPI_Exscan(&is_first, &n_before, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+      io_file = (Driver::proc_ID > 0) ? n_before : 0;
+      MPI_Bcast(&io_file, 1, MPI_INT, 0, io_comm);
+      MPI_Allreduce(&is_first, &n_io_files, 1, MPI_INT, MPI_SUM,
+            MPI_COMM_WORLD);
+   }
+
+   // Gather the frames of an aggregation group to its first processor, whose
+   // frame then holds the cells of the whole group (in processor order)
+   void gather_frame (OutputFrame &frame) {
+      const int n = frame.n_cells;
+      std::vector<int> counts(io_size), displs(io_size, 0);
+      std::vector<double> all;
+      int total = 0;
+      MPI_Gather(&n, 1, MPI_INT, &counts[0], 1, MPI_INT, 0, io_comm);
+      for (int r = 0; r < io_size; r++) {
+         displs[r] = total;
+         total += counts[r];
+      }
+      if (io_rank == 0) {
+         all.resize((n_vars + 1) * total);
+      }
+      for (unsigned int a = 0; a <= n_vars; a++) {
+         MPI_Gatherv(&frame.arrays[a*n], n, MPI_DOUBLE,
+               (io_rank == 0) ? &all[a*total] : NULL, &counts[0], &displs[0],
+               MPI_DOUBLE, 0, io_comm);
+      }
+      if (io_rank == 0) {
+         frame.arrays.swap(all);
+         frame.n_cells = total;
+         frame.file = node_file_name(io_file);
+      }
+   }
+#endif // ifdef PARALLEL_MPI
+
+   // Copy this processor's internal cells into a frame
+   void capture_frame (OutputFrame &frame, const std::string &dirname) {
+      const int first = ilo + Ng;
+      const VarView xv = x.view();
+      frame.dirname = dirname;
+      frame.time = Driver::time;
+      frame.step = Driver::n_step;
+      frame.n_cells = Nx_local;
+      frame.arrays.resize((n_vars + 1) * Nx_local);
+      for (unsigned int i = 0; i < Nx_local; i++) {
+         frame.arrays[i] = xv[first+i];
+      }
+      for (unsigned int v = 0; v < n_vars; v++) {
+         const VarView q = data.view(v);
+         double *out = &frame.arrays[(v+1)*Nx_local];
+         for (unsigned int i = 0; i < Nx_local; i++) {
+            out[i] = q[first+i];
+         }
+      }
+      frame.t_write = 0.0;
+      frame.t_stalled = 0.0;
+      frame.error.clear();
+#ifdef PARALLEL_MPI
+      frame.file = data_file_name(Driver::proc_ID);
+      frame.header = (Driver::proc_ID == 0);
+      if (aggregators_per_node > 0) {
+         gather_frame(frame);
+      }
+#else // PARALLEL_MPI
+      frame.file = data_file_name(0);
+      frame.header = true;
+#endif // PARALLEL_MPI
+   }
+
+   // Write all of a buffer to a file
+   void write_fully (int fd, const char *bytes, std::size_t n,
+         const std::string &filename) {
+      while (n > 0) {
+         const ssize_t written = write(fd, bytes, n);
+         if ((written < 0) && (errno == EINTR)) {
+            continue;
+         } else if (written <= 0) {
+            throw std::ios_base::failure("could not write " + filename);
+         }
+         bytes += written;
+         n -= written;
+      }
+   }
+
+   // Write a frame as text: the header (from one processor) and the data file
+   // --> The rows are formatted by n_threads threads of the pool (which only
+   //     the main thread may use), a block of rows each, into buffers that
+   //     are written with a few large writes.
+   void emit_frame (const OutputFrame &frame, unsigned int n_threads = 1) {
+
+      std::string filename;
+      const std::size_t block = 8192;     // rows per thread per write
+      std::ofstream fout;
+      std::string names;
+      const unsigned int n_columns = n_vars + 1;
+      const std::size_t n = frame.n_cells;
+      std::vector<const double *> columns(n_columns);
+      n_threads = std::max(1ul, std::min<unsigned long>(n_threads,
+               (n + block - 1) / block));
+      std::vector< std::vector<char> > buffers(n_threads);
+      std::vector<std::size_t> lengths(n_threads);
+
+      fs::create_directories(frame.dirname);
+
+      // Write the important header information
+      if (frame.header) {
+         filename = frame.dirname + "/header.txt";
+         fout.open(filename.c_str());
+         fout << "time        = " << frame.time << std::endl;
+         fout << "step        = " << frame.step << std::endl;
+         fout.close();
+      }
+
+      // Write the data
+      filename = frame.dirname + "/" + frame.file;
+      names = "# position\n";
+      for (unsigned int v = 0; v < n_vars; v++) {
+         names += "# " + var_list[v] + "\n";
+      }
+      for (unsigned int c = 0; c < n_columns; c++) {
+         columns[c] = &frame.arrays[c*n];
+      }
+      for (unsigned int t = 0; t < n_threads; t++) {
+         buffers[t].resize(block * TextFormat::max_row_bytes(n_columns));
+      }
+      const int fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC,
+            0666);
+      if (fd < 0) {
+         throw std::ios_base::failure("could not open " + filename);
+      }
+      try {
+         write_fully(fd, names.data(), names.size(), filename);
+         for (std::size_t row = 0; row < n; row += block * n_threads) {
+            const Threads::Task format = [&] (unsigned int t) {
+               const std::size_t first = std::min(n, row + t * block);
+               const std::size_t last = std::min(n, first + block);
+               lengths[t] = TextFormat::format_rows(buffers[t].data(),
+                     columns.data(), n_columns, first, last) -
+                  buffers[t].data();
+            };
+            if (n_threads > 1) {
+               Threads::run(n_threads, format);
+            } else {
+               format(0);
+            }
+            for (unsigned int t = 0; t < n_threads; t++) {
+               write_fully(fd, buffers[t].data(), lengths[t], filename);
+            }
+         }
+      } catch (...) {
+         close(fd);
+         throw;
+      }
+      if (close(fd) != 0) {
+         throw std::ios_base::failure("could not write " + filename);
+      }
+   }
+
+   // The I/O thread
+   void writer_loop () {
+      unsigned int f;
+      while (true) {
+         if (!to_writer->pop(f)) {
+            std::this_thread::sleep_for(io_poll);
+            continue;
+         }
+         if (f == frames.size()) {
+            return;
+         }
+         Clock::time_point t0 = Clock::now();
+         try {
+            emit_frame(frames[f]);
+         } catch (std::exception &e) {
+            frames[f].error = e.what();
+         }
+         frames[f].t_write = Seconds(Clock::now() - t0).count();
+         while (!from_writer->push(f)) {
+            std::this_thread::sleep_for(io_poll);
+         }
+      }
+   }
+
+   // Get a free frame back from the I/O thread (waiting if there is none),
+   // and report on the output it held
+   unsigned int take_frame () {
+
+      std::stringstream ss;
+      unsigned int f;
+      Clock::time_point t0 = Clock::now();
+
+      while (!from_writer->pop(f)) {
+         std::this_thread::sleep_for(io_poll);
+      }
+      OutputFrame &frame = frames[f];
+      if (frame.dirname.empty()) {
+         return f;   // never used
+      }
+      frame.t_stalled = Seconds(Clock::now() - t0).count();
+      if (!frame.error.empty()) {
+         throw std::ios_base::failure(frame.error);
+      }
+
+      // What the write cost, and how much of that the evolution did not see
+      n_async++;
+      sum_write += frame.t_write;
+      sum_stalled += frame.t_stalled;
+      ss << "OUTPUT : finished output \"" << frame.dirname << "\" (";
+      ss << std::scientific << std::setprecision(3) << frame.t_write;
+      ss << " s: " << std::max(frame.t_write - frame.t_stalled, 0.0);
+      ss << " s hidden, " << frame.t_stalled << " s stalled)" << std::endl;
+      Log::write_single(ss.str());
+      frame.dirname.clear();
+      return f;
+   }
+
+   void start_writer (unsigned int n_frames) {
+      frames.resize(n_frames);
+      to_writer.reset(new Threads::SpscQueue<unsigned int>(n_frames + 1));
+      from_writer.reset(new Threads::SpscQueue<unsigned int>(n_frames));
+      for (unsigned int f = 0; f < n_frames; f++) {
+         from_writer->push(f);
+      }
+      writer = std::thread(writer_loop);
+   }
+
+   // Wait for all outputs to be written, then stop the I/O thread
+   void stop_writer () {
+
+      std::stringstream ss;
+
+      for (unsigned int f = 0; f < frames.size(); f++) {
+         take_frame();
+      }
+      to_writer->push(frames.size());
+      writer.join();
+
+      ss << "Background output: " << n_async << " writes, ";
+      ss << std::scientific << std::setprecision(3) << sum_write;
+      ss << " s writing, " << std::max(sum_write - sum_stalled, 0.0);
+      ss << " s hidden, " << sum_stalled << " s stalled";
+      if (sum_write > 0.0) {
+         ss << " (" << std::fixed << std::setprecision(1);
+         ss << 100.0 * std::max(1.0 - sum_stalled / sum_write, 0.0);
+         ss << "% hidden)";
+      }
+      ss << std::endl;
+      Log::write_single(ss.str());
+   }
+
+   // =========================================================================
+   // Output from a child process
+   //    With Grid.fork_output (serial builds only), write_data forks, and
+   // the child writes the output from its copy-on-write image of the grid
+   // while the parent goes on with the evolution.  The pages the parent
+   // changes are copied by the kernel as it changes them, so the output costs
+   // the parent little more than the fork.  Only one child runs at a time: the
+   // next output first waits for the previous child to finish.
+
+   pid_t child_pid = 0;
+   std::string child_name;
+   Clock::time_point child_start;
+
+   // Totals for the summary
+   unsigned int n_forked = 0;
+   double sum_fork = 0.0, sum_child = 0.0, sum_child_stalled = 0.0;
+
+   // Wait for the child (if there is one) and report on its output
+   void reap_writer () {
+
+      std::stringstream ss;
+      int status;
+      Clock::time_point t0 = Clock::now();
+
+      if (child_pid == 0) {
+         return;
+      }
+      while (waitpid(child_pid, &status, 0) < 0) {
+         if (errno != EINTR) {
+            throw std::runtime_error("lost the output child process");
+         }
+      }
+      child_pid = 0;
+      if (!WIFEXITED(status) || (WEXITSTATUS(status) != 0)) {
+         throw std::ios_base::failure("could not write " + child_name);
+      }
+
+      const double t_stalled = Seconds(Clock::now() - t0).count();
+      const double t_child = Seconds(Clock::now() - child_start).count();
+      sum_child_stalled += t_stalled;
+      sum_child += t_child;
+      ss << "OUTPUT : finished output \"" << child_name << "\" (child ";
+      ss << std::scientific << std::setprecision(3) << t_child;
+      ss << " s, " << t_stalled << " s stalled)" << std::endl;
+      Log::write_single(ss.str());
+   }
+
+   // Start a child to write an output: returns true in the child, which must
+   // end with child_write
+   bool fork_writer (const std::string &name) {
+
+      reap_writer();
+
+      Clock::time_point t0 = Clock::now();
+      pid_t pid = fork();
+      if (pid < 0) {
+         throw std::runtime_error("could not fork an output process");
+      }
+      if (pid == 0) {
+         return true;
+      }
+      child_pid = pid;
+      child_name = name;
+      child_start = t0;
+      n_forked++;
+      sum_fork += Seconds(Clock::now() - t0).count();
+      return false;
+   }
+
+   // In the child: do the write and exit
+   // --> _exit skips the destructors and stream buffers (the log file,
+   //     for one) that belong to the parent
+   void child_write (const std::function<void()> &write) {
+      int status = 0;
+      try {
+         write();
+      } catch (...) {
+         status = 1;
+      }
+      _exit(status);
+   }
+
+   // =========================================================================
+   // Set up
+
+   void setup () {
+
+      std::stringstream ss;
+      unsigned int halo_factor;
+      int cell_lo, cell_hi;
+
+      Log::write_single(std::string(79,'_') + "\n");
+      Log::write_single("Grid Setup:\n\n");
+
+      // ----------------------------------------------------------------------
+      // Get parameters
+
+      // Number of guard cells used by one step
+      Ng_step = fmax(1, Hydro::min_guard);
+
+      // Deep halos: keep halo_depth_factor times as many guard cells and
+      // exchange them only every halo_depth_factor steps (0 = choose from the
+      // measured message latency and compute rate)
+      halo_factor = Parameters::get_optional<unsigned int>(
+            "Grid.halo_depth_factor", 1);
+
+      // Number of internal cells
+      Nx_global = Parameters::get_required<unsigned int>("Grid.Nx");
+
+      // Limits
+      xmin = Parameters::get_required<double>("Grid.xmin");
+      xmax = Parameters::get_required<double>("Grid.xmax");
+
+      // Memory layout (aos, soa, or aosoa) and tile width (aosoa only)
+      layout = layout_from_string(
+            Parameters::get_optional<std::string>("Grid.layout", "aos"));
+      tile_width = Parameters::get_optional<unsigned int>(
+            "Grid.tile_width", 8);
+      if (tile_width == 0) {
+         throw std::invalid_argument("Grid.tile_width must be positive");
+      }
+
+      // ----------------------------------------------------------------------
+      // Set up grid
+
+      // Coordinates
+      dx = (xmax - xmin) / Nx_global;
+
+#ifdef PARALLEL_MPI
+      // Determine neighbors
+      if (Driver::proc_ID == 0) {
+         neigh_lo = Driver::n_procs - 1;
+      } else {
+         neigh_lo = Driver::proc_ID - 1;
+      }
+      if (Driver::proc_ID == Driver::n_procs - 1) {
+         neigh_hi = 0;
+      } else {
+         neigh_hi = Driver::proc_ID + 1;
+      }
+      // Print a summary of neighbors
+      ss << "MPI Neighbors : < " << neigh_lo << " | " << Driver::proc_ID;
+      ss << " | " << neigh_hi << " >" << std::endl;
+      Log::write_all(ss.str());
+      Log::write_single("\n");
+
+      // Internal cells on this processor
+      cell_lo = (Nx_global *  Driver::proc_ID   ) / Driver::n_procs;
+      cell_hi = (Nx_global * (Driver::proc_ID+1)) / Driver::n_procs;
+#else // PARALLEL_MPI
+      // Internal cells
+      cell_lo = 0;
+      cell_hi = Nx_global;
+#endif // end ifdef PARALLEL_MPI
+      // Compute size
+      Nx_local = cell_hi - cell_lo;
+
+      // Register the variables (the automatic halo depth needs the count)
+      Hydro::add_variables();
+      InitConds::add_variables();
+      /* Add add_variables() for any other components that want variables. */
+      n_vars = var_list.size();
+
+      // Number of guard cells
+      if (halo_factor == 0) {
+         halo_factor = Driver::choose_halo_depth(Ng_step, Nx_local, n_vars);
+      }
+      halo_depth = halo_factor;
+      Ng = halo_depth * Ng_step;
+      halo_age = halo_depth;  // nothing is filled yet
+
+      // Compute limits
+      ilo = cell_lo - Ng;
+      ihi = cell_hi + Ng;
+      // Verify Nx_local >= Ng or the communication becomes absurd
+      if (Nx_local < Ng) {
+         throw std::length_error("The number of local internal cells must exceed the number of guard cells");
+      }
+      // Split the internal cells into tiles
+      tile_cells = Parameters::get_optional<unsigned int>(
+            "Grid.tile_cells", 0);
+      find_tiles();
+      // Fill the coordinates
+      fill_coordinates();
+
+      // Output format
+      output_format = Parameters::get_optional<std::string>(
+            "Grid.output_format", "ascii");
+      if ((output_format != "ascii") && (output_format != "shared")) {
+         throw std::invalid_argument("unknown Grid.output_format \"" +
+               output_format + "\" (expected ascii or shared)");
+      }
+      // Compression of shared snapshots: a filter, a coder, and a level for
+      // each array (compression_level, or compression_level_<variable>)
+      {
+         std::string filter = Parameters::get_optional<std::string>(
+               "Grid.compression_filter", "xor");
+         std::string coder = Parameters::get_optional<std::string>(
+               "Grid.compression_coder", "auto");
+         int level = Parameters::get_optional<int>(
+               "Grid.compression_level", 0);
+         bool any = false;
+         snapshot_methods.assign(1,
+               Compress::from_string(filter, coder, level));
+         for (unsigned int v = 0; v < n_vars; v++) {
+            int level_v = Parameters::get_optional<int>(
+                  "Grid.compression_level_" + var_list[v], level);
+            snapshot_methods.push_back(
+                  Compress::from_string(filter, coder, level_v));
+         }
+         for (unsigned int a = 0; a < snapshot_methods.size(); a++) {
+            any = any || (snapshot_methods[a].codec != Compress::NO_CODEC);
+         }
+         if (any && (output_format != "shared")) {
+            Log::write_single("WARNING: only shared snapshots are "
+                  "compressed; Grid.compression_level is ignored\n");
+            snapshot_methods.assign(n_vars + 1, Compress::none);
+         } else if (!any) {
+            snapshot_methods.clear();
+         }
+
+         // Visualization snapshots (Driver.viz_dt and Driver.viz_dn) are
+         // quantized within viz_abs_error or viz_rel_error (or
+         // viz_abs_error_<variable> and viz_rel_error_<variable>), whichever
+         // is tighter, and compressed at viz_level
+         double abs_error = Parameters::get_optional<double>(
+               "Grid.viz_abs_error", 0.0);
+         double rel_error = Parameters::get_optional<double>(
+               "Grid.viz_rel_error", 1e-4);
+         viz_coder = coder;
+         viz_level = Parameters::get_optional<int>("Grid.viz_level", 6);
+         Compress::from_string("none", viz_coder, viz_level);   // (checks)
+         viz_abs_error.clear();
+         viz_rel_error.clear();
+         for (unsigned int v = 0; v < n_vars; v++) {
+            viz_abs_error.push_back(Parameters::get_optional<double>(
+                     "Grid.viz_abs_error_" + var_list[v], abs_error));
+            viz_rel_error.push_back(Parameters::get_optional<double>(
+                     "Grid.viz_rel_error_" + var_list[v], rel_error));
+            if ((viz_abs_error[v] < 0.0) || (viz_rel_error[v] < 0.0)) {
+               throw std::invalid_argument("visualization error bounds "
+                     "must not be negative");
+            }
+         }
+      }
+      // Delta checkpoints: after each full shared snapshot, delta_every
+      // deltas holding the blocks of delta_block cells that changed by more
+      // than delta_tolerance (or at all)
+      {
+         unsigned int every = Parameters::get_optional<unsigned int>(
+               "Grid.delta_every", 0);
+         delta_block = Parameters::get_optional<unsigned int>(
+               "Grid.delta_block", 256);
+         delta_tolerance = Parameters::get_optional<double>(
+               "Grid.delta_tolerance", 0.0);
+         if ((delta_block == 0) || !(delta_tolerance >= 0.0)) {
+            throw std::invalid_argument("Grid.delta_block must be positive "
+                  "and Grid.delta_tolerance must not be negative");
+         }
+         if ((every > 0) && (output_format != "shared")) {
+            Log::write_single("WARNING: delta checkpoints need shared "
+                  "snapshots; Grid.delta_every is ignored\n");
+            every = 0;
+         }
+         delta_every = every;
+      }
+      // Node-level aggregation
+      aggregators_per_node = Parameters::get_optional<unsigned int>(
+            "Grid.aggregators_per_node", 0);
+#ifdef PARALLEL_MPI
+      if (aggregators_per_node > 0) {
+         setup_aggregation();
+      }
+#endif // ifdef PARALLEL_MPI
+
+      // Background writing (text output only), with output_buffers frames
+      {
+         bool async = Parameters::get_optional<bool>(
+               "Grid.async_output", false);
+         unsigned int n_frames = Parameters::get_optional<unsigned int>(
+               "Grid.output_buffers", 2);
+         if (n_frames == 0) {
+            throw std::invalid_argument("Grid.output_buffers must be positive");
+         }
+         async_output = async && (output_format == "ascii");
+         if (async_output) {
+            start_writer(n_frames);
+         }
+      }
+      // Writing from a child process (serial builds only: a forked copy of
+      // an MPI process cannot use MPI)
+      {
+         bool fork_wanted = Parameters::get_optional<bool>(
+               "Grid.fork_output", false);
+         if (fork_wanted && async_output) {
+            throw std::invalid_argument(
+                  "Grid.fork_output and Grid.async_output exclude each other");
+         }
+#ifdef PARALLEL_MPI
+         if (fork_wanted) {
+            Log::write_single("WARNING: Grid.fork_output is only available "
+                  "without MPI; writing the output directly\n");
+         }
+         fork_output = false;
+#else // ifdef PARALLEL_MPI
+         fork_output = fork_wanted;
+#endif // ifdef PARALLEL_MPI
+      }
+
+      // Load balancing: check every balance_interval steps (0 = never) and
+      // rebalance when the slowest processor takes more than balance_threshold
+      // times the average
+      balance_interval = Parameters::get_optional<unsigned int>(
+            "Grid.balance_interval", 0);
+      balance_threshold = Parameters::get_optional<double>(
+            "Grid.balance_threshold", 1.1);
+
+      // Set up the grid
+      data.init(n_vars);
+
+#ifdef PARALLEL_MPI
+      // Guard cell exchange
+      setup_halo_requests();
+#endif // ifdef PARALLEL_MPI
+
+      // Reserve the per-step workspaces
+      // --> None are reserved by default: the pools grow on first use, so a
+      //     run only holds the workspaces it borrows (the staged Hydro
+      //     kernel borrows three face workspaces on its first step; the
+      //     fused kernel borrows none).
+      cell_scratch.reserve(Parameters::get_optional<unsigned int>(
+               "Grid.scratch_cells", 0), n_vars);
+      face_scratch.reserve(Parameters::get_optional<unsigned int>(
+               "Grid.scratch_faces", 0), n_vars);
+
+      if (balance_interval > 0) {
+         ss.clear();
+         ss.str("");
+         ss << "Load balancing: checked every " << balance_interval;
+         ss << " steps, threshold " << balance_threshold << std::endl;
+         Log::write_single(ss.str());
+      }
+
+      ss.clear();
+      ss.str("");
+      ss << "Guard cells: " << Ng << " (" << Ng_step << " per step, ";
+      ss << "exchanged every " << halo_depth << " step";
+      ss << ((halo_depth > 1) ? "s" : "") << ")" << std::endl;
+      if (tile_cells > 0) {
+         ss << "Task tiles: " << tile_cells << " cells (";
+         ss << tile_cells * n_vars * sizeof(double) << " bytes) each";
+         ss << std::endl;
+      }
+      ss << "Output format: " << output_format;
+      if (async_output) {
+         ss << " (written in the background, " << frames.size();
+         ss << " buffer" << ((frames.size() > 1) ? "s" : "") << ")";
+      }
+      if (fork_output) {
+         ss << " (written by a child process)";
+      }
+#ifdef PARALLEL_MPI
+      if (aggregators_per_node > 0) {
+         ss << "\nOutput aggregation: " << n_io_files << " writer";
+         ss << ((n_io_files > 1) ? "s" : "") << " (up to ";
+         ss << aggregators_per_node << " per node)";
+      }
+#endif // ifdef PARALLEL_MPI
+      if (delta_every > 0) {
+         ss << "\nDelta checkpoints: " << delta_every << " between snapshots";
+         ss << " (blocks of " << delta_block << " cells, ";
+         if (delta_tolerance > 0.0) {
+            ss << "tolerance " << delta_tolerance << ")";
+         } else {
+            ss << "exact)";
+         }
+      }
+      for (unsigned int a = 0; a < snapshot_methods.size(); a++) {
+         ss << ((a == 0) ? "\nSnapshot compression: position " : ", ");
+         ss << ((a > 0) ? var_list[a-1] + " " : "");
+         ss << Compress::to_string(snapshot_methods[a]);
+      }
+      ss << std::endl;
+      ss << std::endl;
+      Log::write_single(ss.str());
+
+      ss.clear();
+      ss.str("");
+      ss << "Simulating with " << n_vars << " variables";
+      ss << " (layout " << layout_to_string(layout);
+      if (layout == AOSOA) {
+         ss << ", tile width " << tile_width;
+      }
+      ss << "):" << std::endl;
+      Log::write_single(ss.str());
+      unsigned int v_width = fmax(floor(log10(n_vars)) + 1, 2);
+      for (unsigned int v = 0; v < n_vars; v++) {
+         ss.clear();
+         ss.str("");
+         ss << "  ";
+         ss << std::setfill('0') << std::setw(v_width) << v;
+         ss << " : " << var_list[v] << std::endl;
+         Log::write_single(ss.str());
+      }
+      Log::write_single("\n");
+   }
+
+   // =========================================================================
+   // Clean up
+
+   void cleanup () {
+
+      std::stringstream ss;
+
+      // Finish writing the output
+      if (async_output) {
+         Log::write_single(std::string(79,'_') + "\n");
+         Log::write_single("Grid Output:\n\n");
+         stop_writer();
+         Log::write_single("\n");
+      }
+      if (fork_output) {
+         Log::write_single(std::string(79,'_') + "\n");
+         Log::write_single("Grid Output:\n\n");
+         reap_writer();
+         ss << "Child process output: " << n_forked << " writes, ";
+         ss << std::scientific << std::setprecision(3) << sum_child;
+         ss << " s in the children, " << sum_fork << " s forking, ";
+         ss << sum_child_stalled << " s stalled" << std::endl;
+         Log::write_single(ss.str());
+         Log::write_single("\n");
+         ss.clear();
+         ss.str("");
+      }
+
+#ifdef PARALLEL_MPI
+      if (io_comm != MPI_COMM_NULL) {
+         MPI_Comm_free(&io_comm);
+      }
+#endif // ifdef PARALLEL_MPI
+
+      // Report how much of the scratch space was used
+      Log::write_single(std::string(79,'_') + "\n");
+      Log::write_single("Grid Scratch Usage:\n\n");
+      ss << "   cell workspaces : high-water " << cell_scratch.peak();
+      ss << " of " << cell_scratch.size() << " allocated (";
+      ss << cell_scratch.peak_bytes() << " bytes)" << std::endl;
+      ss << "   face workspaces : high-water " << face_scratch.peak();
+      ss << " of " << face_scratch.size() << " allocated (";
+      ss << face_scratch.peak_bytes() << " bytes)" << std::endl;
+      Log::write_single(ss.str());
+
+      // Free the workspaces; the grids will call their destructors when they
+      // go out of scope, and nothing else needs to be done here.
+      cell_scratch.clear();
+      face_scratch.clear();
+
+#ifdef PARALLEL_MPI
+      // Free the persistent requests (must happen before MPI_Finalize)
+      free_halo_requests();
+#endif // ifdef PARALLEL_MPI
+   }
+
+   // =========================================================================
+   // Change the local grid
+   //    Makes cell_lo to cell_hi-1 the internal cells of this processor.  The
+   // coordinates, the data grid, the tiles, the guard cell exchange, and the
+   // workspaces are all rebuilt for the new limits; the contents of the data
+   // grid are lost (the caller fills it), and the guard cells must be
+   // exchanged before the next step.
+
+   void set_local_cells (int cell_lo, int cell_hi) {
+
+      if (cell_hi - cell_lo < int(Ng)) {
+         throw std::length_error("The number of local internal cells must exceed the number of guard cells");
+      }
+      ilo.reset(cell_lo - int(Ng));
+      ihi.reset(cell_hi + int(Ng));
+      Nx_local.reset(cell_hi - cell_lo);
+
+      fill_coordinates();
+      find_tiles();
+      data.init(n_vars);
+#ifdef PARALLEL_MPI
+      free_halo_requests();
+      setup_halo_requests();
+#endif // ifdef PARALLEL_MPI
+      cell_scratch.reserve(cell_scratch.size(), n_vars);
+      face_scratch.reserve(face_scratch.size(), n_vars);
+      halo_age = halo_depth;
+      // The delta chain only knows the old cells: start a new one
+      delta_reference.clear();
+   }
+
+   // =========================================================================
+   // Load balancing
+   //    Each processor reports the time it spent on every step.  Every
+   // balance_interval steps, the processors compare their times since the
+   // last check; if the slowest took more than balance_threshold times the
+   // average, the cells are redistributed.  Each processor's time is spread
+   // evenly over its cells to give a cost per cell, and the new limits cut
+   // the prefix sum of that cost into equal parts (keeping at least Ng cells
+   // on each processor).  The internal cells then move to their new owners
+   // with a single MPI_Alltoallv; in one dimension this is mostly an
+   // exchange between neighbors, but a large shift may pass a processor by.
+   //    The log shows the measured imbalance before and the imbalance
+   // predicted by the cost model after.
+
+   void balance_load (double step_time) {
+
+#ifdef PARALLEL_MPI
+      // ----------------------------------------------------------------------
+      // Declare variables
+
+      const int P = Driver::n_procs;
+      const int me = Driver::proc_ID;
+      std::vector<double> local(2), all(2*P);
+      std::vector<double> cost(P), density(P);
+      std::vector<int> old_lo(P+1), new_lo(P+1);
+      std::vector<int> send_counts(P), send_displs(P);
+      std::vector<int> recv_counts(P), recv_displs(P);
+      std::vector<double> send, recv;
+      double total = 0.0, max_cost = 0.0, max_new = 0.0;
+      double target, before, after, sum;
+      std::stringstream ss;
+      int min_cells = Ng;
+      int moved = 0;
+      int r;
+
+      // ----------------------------------------------------------------------
+      // Time to check?
+
+      if (balance_interval == 0) {
+         return;
+      }
+      balance_time += step_time;
+      balance_steps++;
+      if (balance_steps < balance_interval) {
+         return;
+      }
+
+      // ----------------------------------------------------------------------
+      // Measure the imbalance
+
+      local[0] = balance_time;
+      local[1] = Nx_local;
+      MPI_Allgather(&local[0], 2, MPI_DOUBLE, &all[0], 2, MPI_DOUBLE,
+            MPI_COMM_WORLD);
+      balance_time = 0.0;
+      balance_steps = 0;
+
+      old_lo[0] = 0;
+      for (r = 0; r < P; r++) {
+         cost[r] = all[2*r];
+         old_lo[r+1] = old_lo[r] + int(all[2*r+1]);
+         density[r] = cost[r] / (old_lo[r+1] - old_lo[r]);
+         total += cost[r];
+         max_cost = (cost[r] > max_cost) ? cost[r] : max_cost;
+      }
+      if (total <= 0.0) {
+         return;
+      }
+      before = max_cost * P / total;
+
+      ss << "LOAD   : imbalance " << std::fixed << std::setprecision(3);
+      ss << before;
+      if (before <= balance_threshold) {
+         ss << std::endl;
+         Log::write_single(ss.str());
+         return;
+      }
+
+      // ----------------------------------------------------------------------
+      // New limits: cut the cumulative cost into P equal parts
+
+      new_lo[0] = 0;
+      new_lo[P] = Nx_global;
+      r = 0;
+      sum = 0.0;     // cost of ranks 0 to r-1
+      for (int k = 1; k < P; k++) {
+         target = total * k / P;
+         while ((r < P-1) && (sum + cost[r] < target)) {
+            sum += cost[r];
+            r++;
+         }
+         new_lo[k] = old_lo[r] +
+            int(floor((target - sum) / density[r] + 0.5));
+      }
+      // Keep at least min_cells cells on every processor
+      for (int k = 1; k < P; k++) {
+         if (new_lo[k] < new_lo[k-1] + min_cells) {
+            new_lo[k] = new_lo[k-1] + min_cells;
+         }
+      }
+      for (int k = P-1; k > 0; k--) {
+         if (new_lo[k] > new_lo[k+1] - min_cells) {
+            new_lo[k] = new_lo[k+1] - min_cells;
+         }
+      }
+
+      // Predicted imbalance: the cost of each new range under the old costs
+      // per cell
+      for (int k = 0; k < P; k++) {
+         sum = 0.0;
+         for (r = 0; r < P; r++) {
+            int lo = std::max(new_lo[k], old_lo[r]);
+            int hi = std::min(new_lo[k+1], old_lo[r+1]);
+            if (hi > lo) {
+               sum += (hi - lo) * density[r];
+            }
+         }
+         max_new = (sum > max_new) ? sum : max_new;
+      }
+      after = max_new * P / total;
+      if ((after >= before) || (new_lo == old_lo)) {
+         ss << " (no better split found)" << std::endl;
+         Log::write_single(ss.str());
+         return;
+      }
+
+      // ----------------------------------------------------------------------
+      // Move the cells
+
+      // What goes where: this processor's old cells that fall in each
+      // processor's new range, and the reverse
+      for (r = 0; r < P; r++) {
+         int lo = std::max(old_lo[me], new_lo[r]);
+         int hi = std::min(old_lo[me+1], new_lo[r+1]);
+         send_counts[r] = (hi > lo) ? (hi - lo) * n_vars : 0;
+         send_displs[r] = (r == 0) ? 0 : send_displs[r-1] + send_counts[r-1];
+         lo = std::max(old_lo[r], new_lo[me]);
+         hi = std::min(old_lo[r+1], new_lo[me+1]);
+         recv_counts[r] = (hi > lo) ? (hi - lo) * n_vars : 0;
+         recv_displs[r] = (r == 0) ? 0 : recv_displs[r-1] + recv_counts[r-1];
+         if (r != me) {
+            moved += recv_counts[r] / n_vars;
+         }
+      }
+
+      // Pack the internal cells in order (the old internal cells are exactly
+      // the union of the send ranges, in processor order)
+      send.resize(Nx_local * n_vars);
+      for (int i = 0; i < int(Nx_local); i++) {
+         for (unsigned int v = 0; v < n_vars; v++) {
+            send[i*n_vars+v] = data(ilo+Ng+i, v);
+         }
+      }
+      recv.resize((new_lo[me+1] - new_lo[me]) * n_vars);
+      MPI_Alltoallv(&send[0], &send_counts[0], &send_displs[0], MPI_DOUBLE,
+            &recv[0], &recv_counts[0], &recv_displs[0], MPI_DOUBLE,
+            MPI_COMM_WORLD);
+
+      // Resize and unpack
+      set_local_cells(new_lo[me], new_lo[me+1]);
+      for (int i = 0; i < int(Nx_local); i++) {
+         for (unsigned int v = 0; v < n_vars; v++) {
+            data(ilo+Ng+i, v) = recv[i*n_vars+v];
+         }
+      }
+
+      MPI_Allreduce(MPI_IN_PLACE, &moved, 1, MPI_INT, MPI_SUM,
+            MPI_COMM_WORLD);
+      ss << " --> rebalanced (" << moved << " cells moved), predicted ";
+      ss << "imbalance " << after << std::endl;
+      Log::write_single(ss.str());
+#endif // ifdef PARALLEL_MPI
+   }
+
+   // =========================================================================
+   // Fill boundary conditions
+   //    The exchange is split in two phases so that work which does not need
+   // the guard cells can run while the messages are in flight:
+   // - begin_boundary_exchange starts the sends of the Ng internal cells at
+   //   each end and the receives into the guard cells
+   // - finish_boundary_exchange waits for the messages to complete
+   // Between the two calls the guard cells must not be read, and the
+   // internal cells being sent (the Ng cells at each end) must not be
+   // modified: MPI reads and writes the grid data directly.
+
+   void begin_boundary_exchange() {
+
+      assert(!exchange_active);
+      exchange_active = true;
+      halo_age = 0;
+
+#ifdef PARALLEL_MPI
+      // The requests send straight from and receive straight into the grid
+      // data (see setup_halo_requests); just start them
+      MPI_Startall(4, halo_requests);
+#else // ifdef PARALLEL_MPI
+      // Periodic boundaries on a single processor: copy directly
+      const int lo_guard = ilo;           // lower guard cells
+      const int lo_real  = ilo + Ng;      // lowest internal cells
+      const int hi_real  = ihi - 2*Ng;    // highest internal cells
+      const int hi_guard = ihi - Ng;      // upper guard cells
+      const int ng = Ng;
+      const unsigned int nv = n_vars;
+      for (unsigned int v = 0; v < nv; v++) {
+         const VarView q = data.view(v);
+         for (int i = 0; i < ng; i++) {
+            q[lo_guard+i] = q[hi_real+i];
+            q[hi_guard+i] = q[lo_real+i];
+         }
+      }
+#endif // ifdef PARALLEL_MPI
+   }
+
+   void finish_boundary_exchange() {
+
+      assert(exchange_active);
+      exchange_active = false;
+
+#ifdef PARALLEL_MPI
+      MPI_Status statuses[4];    // Statuses of sends/receives
+      int mpi_return;
+      // Wait for sends and receives to finish
+      mpi_return = MPI_Waitall(4, halo_requests, statuses);
+      if (mpi_return != MPI_SUCCESS) {
+         std::cerr << "boundary condition/guard cell fill failed";
+         std::cerr << std::endl;
+         MPI_Abort(MPI_COMM_WORLD, mpi_return);
+      }
+#endif // ifdef PARALLEL_MPI
+   }
+
+   // Check whether the messages have arrived, without waiting; if they have,
+   // the exchange is finished (as by finish_boundary_exchange)
+   bool test_boundary_exchange() {
+
+      assert(exchange_active);
+
+#ifdef PARALLEL_MPI
+      MPI_Status statuses[4];    // Statuses of sends/receives
+      int mpi_return;
+      int done;
+      mpi_return = MPI_Testall(4, halo_requests, &done, statuses);
+      if (mpi_return != MPI_SUCCESS) {
+         std::cerr << "boundary condition/guard cell fill failed";
+         std::cerr << std::endl;
+         MPI_Abort(MPI_COMM_WORLD, mpi_return);
+      }
+      if (!done) {
+         return false;
+      }
+#endif // ifdef PARALLEL_MPI
+
+      exchange_active = false;
+      return true;
+   }
+
+   void fill_boundary_conditions() {
+      begin_boundary_exchange();
+      finish_boundary_exchange();
+   }
+
+   // =========================================================================
+   // Deep halos
+   //    With k = halo_depth, each exchange fills k*Ng_step guard cells.  The
+   // step right after an exchange can update every cell but the outer
+   // Ng_step at each end; each further step loses another Ng_step cells at
+   // each end, so after k steps only the internal cells are still valid and
+   // the guard cells must be exchanged again.  The cells updated outside the
+   // internal cells repeat work done by the neighbors, but with the same
+   // arithmetic on the same values, so the results do not depend on k.
+
+   bool exchange_due() {
+      return halo_age >= halo_depth;
+   }
+
+   void end_step() {
+      halo_age++;
+   }
+
+   // =========================================================================
+   // Shared snapshot files
+   //    A shared snapshot holds the whole grid in a single binary file (see
+   // Snapshot.hpp), written by all processors at once with collective
+   // MPI-IO, so there is one file (and no directory) per output no matter
+   // how many processors there are.  Each processor writes its own cells of
+   // each array at an offset computed from ilo, so the file does not depend
+   // on how the cells were distributed, and it can be read back by any number
+   // of processors.
+
+   // The positions and variables, in the order they are in the file
+   Snapshot::Info snapshot_info () {
+      Snapshot::Info info;
+      info.time = Driver::time;
+      info.step = Driver::n_step;
+      info.n_cells = Nx_global;
+      info.xmin = xmin;
+      info.xmax = xmax;
+      info.names.push_back("position");
+      for (unsigned int v = 0; v < n_vars; v++) {
+         info.names.push_back(var_list[v]);
+      }
+      info.methods = snapshot_methods;
+      return info;
+   }
+
+   // Write info and the data to the file, with info.methods, and return the
+   // size of the file (for a compressed snapshot written by a child process,
+   // which alone knows the size, that of the file uncompressed)
+   std::size_t write_snapshot (const std::string &filename,
+         Snapshot::Info &info) {
+
+      // ----------------------------------------------------------------------
+      // Declare variables
+
+      std::stringstream ss;
+      std::vector<char> header;
+      std::vector<double> buffer((n_vars + 1) * Nx_local);
+      const int first = ilo + Ng;
+      bool report = true;
+
+      // ----------------------------------------------------------------------
+      // Write the output
+
+      // This processor's part of each array
+      const VarView xv = x.view();
+      for (unsigned int i = 0; i < Nx_local; i++) {
+         buffer[i] = xv[first+i];
+      }
+      for (unsigned int v = 0; v < n_vars; v++) {
+         const VarView q = data.view(v);
+         for (unsigned int i = 0; i < Nx_local; i++) {
+            buffer[(v+1)*Nx_local + i] = q[first+i];
+         }
+      }
+
+#ifdef PARALLEL_MPI
+      // With compression, each processor compresses its part of each array
+      // (one chunk), and every processor needs every chunk's cells and size
+      // to lay out the file
+      std::vector< std::vector<char> > packed(n_vars + 1);
+      if (info.compressed()) {
+         const unsigned int n_mine = n_vars + 3;
+         std::vector<unsigned long> mine(n_mine);
+         std::vector<unsigned long> all(n_mine * Driver::n_procs);
+         mine[0] = first;
+         mine[1] = Nx_local;
+         for (unsigned int a = 0; a <= n_vars; a++) {
+            packed[a] = Compress::compress(&buffer[a*Nx_local], Nx_local,
+                  info.methods[a]);
+            mine[a+2] = packed[a].size();
+         }
+         MPI_Allgather(&mine[0], n_mine, MPI_UNSIGNED_LONG, &all[0], n_mine,
+               MPI_UNSIGNED_LONG, MPI_COMM_WORLD);
+         info.chunks.assign(n_vars + 1,
+               std::vector<Snapshot::Chunk>(Driver::n_procs));
+         for (int p = 0; p < Driver::n_procs; p++) {
+            for (unsigned int a = 0; a <= n_vars; a++) {
+               info.chunks[a][p].first = all[p*n_mine];
+               info.chunks[a][p].count = all[p*n_mine + 1];
+               info.chunks[a][p].bytes = all[p*n_mine + a + 2];
+            }
+         }
+      }
+      header = Snapshot::encode(info);
+
+      // With aggregation, MPI-IO collects the data on as many processors
+      MPI_Info hints = MPI_INFO_NULL;
+      if (aggregators_per_node > 0) {
+         std::stringstream cb_nodes;
+         cb_nodes << n_io_files;
+         std::string value = cb_nodes.str();
+         MPI_Info_create(&hints);
+         MPI_Info_set(hints, (char *)"cb_nodes", (char *)value.c_str());
+         MPI_Info_set(hints, (char *)"romio_cb_write", (char *)"enable");
+      }
+
+      MPI_File fh;
+      MPI_Status status;
+      const int opened = MPI_File_open(MPI_COMM_WORLD,
+            (char *)filename.c_str(), MPI_MODE_CREATE | MPI_MODE_WRONLY, hints,
+            &fh);
+      if (hints != MPI_INFO_NULL) {
+         MPI_Info_free(&hints);
+      }
+      if (opened != MPI_SUCCESS) {
+         throw std::ios_base::failure("could not open " + filename);
+      }
+      MPI_File_set_size(fh, Snapshot::file_size(info));
+      if (Driver::proc_ID == 0) {
+         MPI_File_write_at(fh, 0, &header[0], header.size(), MPI_CHAR,
+               &status);
+      }
+      for (unsigned int a = 0; a <= n_vars; a++) {
+         if (info.compressed()) {
+            MPI_File_write_at_all(fh, info.chunks[a][Driver::proc_ID].offset,
+                  packed[a].data(), packed[a].size(), MPI_CHAR, &status);
+         } else {
+            MPI_File_write_at_all(fh, info.offsets[a] + first*sizeof(double),
+                  &buffer[a*Nx_local], Nx_local, MPI_DOUBLE, &status);
+         }
+      }
+      MPI_File_close(&fh);
+#else // ifdef PARALLEL_MPI
+      std::vector<const double *> arrays;
+      for (unsigned int a = 0; a <= n_vars; a++) {
+         arrays.push_back(&buffer[a*Nx_local]);
+      }
+      if (!fork_output) {
+         Snapshot::write(filename, info, arrays);
+      } else if (fork_writer(filename)) {
+         child_write([&] { Snapshot::write(filename, info, arrays); });
+      } else {
+         report = false;   // only the child knows the size
+      }
+#endif // ifdef PARALLEL_MPI
+
+      // How well the data compressed
+      if (info.compressed() && report) {
+         const double raw = (n_vars + 1.0) * Nx_global * sizeof(double);
+         const double stored = Snapshot::file_size(info);
+         ss.clear();
+         ss.str("");
+         ss << "OUTPUT : compressed " << std::setprecision(0) << std::fixed;
+         ss << raw << " to " << stored << " bytes (ratio ";
+         ss << std::setprecision(2) << raw / stored << ")" << std::endl;
+         Log::write_single(ss.str());
+      }
+
+      return Snapshot::file_size(info);
+   }
+
+   std::string write_shared () {
+      std::stringstream ss;
+      Snapshot::Info info = snapshot_info();
+      ss << std::setfill('0') << std::setw(Driver::n_width) << Driver::n_step;
+      std::string filename = Driver::output_dir + "step_" + ss.str() + ".snap";
+      write_snapshot(filename, info);
+      return filename;
+   }
+
+   std::string write_visualization () {
+
+      // ----------------------------------------------------------------------
+      // Declare variables
+
+      std::stringstream ss;
+      std::string filename;
+      Snapshot::Info info = snapshot_info();
+      std::vector<double> lo(n_vars), hi(n_vars);
+      const Compress::Method lossless =
+         Compress::from_string("xor", viz_coder, viz_level);
+
+      // ----------------------------------------------------------------------
+      // Choose the error bounds
+
+      // The range of each variable, for the relative bounds
+      for (unsigned int v = 0; v < n_vars; v++) {
+         const VarView q = data.view(v);
+         lo[v] = std::numeric_limits<double>::infinity();
+         hi[v] = -std::numeric_limits<double>::infinity();
+         for (int i = ilo + Ng; i < ihi - int(Ng); i++) {
+            lo[v] = std::min(lo[v], q[i]);
+            hi[v] = std::max(hi[v], q[i]);
+         }
+      }
+#ifdef PARALLEL_MPI
+      MPI_Allreduce(MPI_IN_PLACE, &lo[0], n_vars, MPI_DOUBLE, MPI_MIN,
+            MPI_COMM_WORLD);
+      MPI_Allreduce(MPI_IN_PLACE, &hi[0], n_vars, MPI_DOUBLE, MPI_MAX,
+            MPI_COMM_WORLD);
+#endif // ifdef PARALLEL_MPI
+
+      // The positions are kept exactly; each variable gets the tighter of
+      // its bounds (and is kept exactly if it has none, such as a relative
+      // bound on a constant)
+      info.methods.assign(1, lossless);
+      for (unsigned int v = 0; v < n_vars; v++) {
+         double bound = viz_abs_error[v];
+         const double relative = viz_rel_error[v] * (hi[v] - lo[v]);
+         if ((relative > 0.0) && std::isfinite(relative) &&
+               ((bound == 0.0) || (relative < bound))) {
+            bound = relative;
+         }
+         info.methods.push_back((bound > 0.0) ?
+               Compress::quantize(bound, viz_coder, viz_level) : lossless);
+      }
+
+      // ----------------------------------------------------------------------
+      // Write the output
+
+      ss << std::setfill('0') << std::setw(Driver::n_width) << Driver::n_step;
+      filename = Driver::output_dir + "viz_" + ss.str() + ".snap";
+      write_snapshot(filename, info);
+
+      return filename;
+   }
+
+   void read_shared (std::string filename) {
+
+      // ----------------------------------------------------------------------
+      // Declare variables
+
+      std::stringstream ss;
+      Snapshot::Info info;
+      std::vector<int> idx(n_vars);
+      std::vector<double> buffer(Nx_local);
+      const int first = ilo + Ng;
+      int pos;
+
+      // ----------------------------------------------------------------------
+      // Read and check the header
+
+#ifdef PARALLEL_MPI
+      // Processor 0 reads the header and passes it on
+      MPI_File fh;
+      MPI_Status status;
+      std::vector<char> header(sizeof(Snapshot::FileHeader));
+      unsigned long n;
+      if (MPI_File_open(MPI_COMM_WORLD, (char *)filename.c_str(),
+               MPI_MODE_RDONLY, MPI_INFO_NULL, &fh) != MPI_SUCCESS) {
+         throw std::ios_base::failure("could not open " + filename);
+      }
+      if (Driver::proc_ID == 0) {
+         MPI_File_read_at(fh, 0, &header[0], header.size(), MPI_CHAR,
+               &status);
+         header.resize(Snapshot::header_size(&header[0], header.size()));
+         MPI_File_read_at(fh, 0, &header[0], header.size(), MPI_CHAR,
+               &status);
+      }
+      n = header.size();
+      MPI_Bcast(&n, 1, MPI_UNSIGNED_LONG, 0, MPI_COMM_WORLD);
+      header.resize(n);
+      MPI_Bcast(&header[0], n, MPI_CHAR, 0, MPI_COMM_WORLD);
+      info = Snapshot::decode(&header[0], header.size());
+#else // ifdef PARALLEL_MPI
+      Snapshot::File file(filename);
+      info = file.info();
+#endif // ifdef PARALLEL_MPI
+
+      if (info.n_cells != Nx_global) {
+         throw std::length_error("length of file does not match Grid");
+      }
+      for (unsigned int a = 0; a < info.methods.size(); a++) {
+         if (Compress::lossy(info.methods[a])) {
+            throw std::invalid_argument(filename + " is a visualization "
+                  "snapshot (not exact), which cannot be used to restart");
+         }
+      }
+      pos = info.find("position");
+      for (unsigned int v = 0; v < n_vars; v++) {
+         idx[v] = info.find(var_list[v]);
+         if (idx[v] < 0) {
+            throw std::out_of_range("variable missing from data file");
+         }
+      }
+
+      Driver::time = info.time;
+      Driver::n_step = info.step;
+      ss << "\nRestarting from step " << Driver::n_step;
+      ss << " and time " << Driver::time << ".\n\n";
+      Log::write_single(std::string(79,'_')+"\n");
+      Log::write_single(ss.str());
+
+      // ----------------------------------------------------------------------
+      // Read this processor's cells
+
+      for (unsigned int v = 0; v <= n_vars; v++) {
+         // v = n_vars is the positions (if the file has them)
+         const int a = (v < n_vars) ? idx[v] : pos;
+         if (a < 0) {
+            continue;
+         }
+#ifdef PARALLEL_MPI
+         if (info.chunks.empty()) {
+            MPI_File_read_at_all(fh, info.offsets[a] + first*sizeof(double),
+                  &buffer[0], Nx_local, MPI_DOUBLE, &status);
+         } else {
+            // Only the chunks that hold this processor's cells
+            std::vector<char> bytes;
+            Snapshot::read_chunks(info, a, first, Nx_local, &buffer[0],
+                  [&] (unsigned int c) {
+                     const Snapshot::Chunk &chunk = info.chunks[a][c];
+                     bytes.resize(chunk.bytes);
+                     MPI_File_read_at(fh, chunk.offset, bytes.data(),
+                           chunk.bytes, MPI_CHAR, &status);
+                     return (const char *)bytes.data();
+                  });
+         }
+#else // ifdef PARALLEL_MPI
+         file.read(a, first, Nx_local, &buffer[0]);
+#endif // ifdef PARALLEL_MPI
+         const VarView q = (v < n_vars) ? data.view(v) : x.view();
+         for (unsigned int i = 0; i < Nx_local; i++) {
+            q[first+i] = buffer[i];
+         }
+      }
+#ifdef PARALLEL_MPI
+      MPI_File_close(&fh);
+#endif // ifdef PARALLEL_MPI
+   }
+
+   // =========================================================================
+   // Delta checkpoints
+   //    With Grid.delta_every = n, shared snapshots form chains: a full
+   // snapshot (step_N.snap) followed by n deltas (step_N.delta, see
+   // Snapshot.hpp), each holding only the blocks of delta_block cells in
+   // which some value changed since the output before it (by more than
+   // delta_tolerance, if that is set).  Every processor keeps the values of
+   // its cells as the chain holds them, and compares against those; the
+   // blocks that changed are found by all processors together, since a
+   // block may span several of them.  A restart from a delta reads the
+   // chain's snapshot and applies the deltas up to it, checking each
+   // delta's blocks and the grid it leads to against its checksums.
+   //    The deltas are not compressed, so a delta that would store most of
+   // the blocks, or more data than the chain's snapshot holds, is replaced
+   // by a full snapshot that starts a new chain.
+   // --> With a tolerance, the values the chain holds (and so a restart) may
+   //     be off by up to delta_tolerance.
+   // --> A change in the local cells (load balancing) starts a new chain.
+
+   // Has a value moved far enough to be stored?
+   inline bool delta_changed (double value, double reference,
+         double tolerance) {
+      if (tolerance > 0.0) {
+         return !(std::fabs(value - reference) <= tolerance);
+      }
+      return std::memcmp(&value, &reference, sizeof(double)) != 0;
+   }
+
+   // The name of the output of the chain at a step
+   std::string chain_file_name (const std::string &dir, unsigned long step,
+         const std::string &extension) {
+      std::stringstream ss;
+      ss << dir << "step_";
+      ss << std::setfill('0') << std::setw(Driver::n_width) << step;
+      ss << extension;
+      return ss.str();
+   }
+
+   // The stored blocks that hold some of this processor's cells are k_lo to
+   // k_hi-1; a run is a stretch of them with consecutive numbers (stored
+   // one after another), and the cells lo to hi-1 are this processor's part
+   // of it
+   struct DeltaRun {
+      unsigned long k;        // the first stored block of the run
+      unsigned long lo, hi;   // the cells
+   };
+
+   std::vector<DeltaRun> local_runs (const Snapshot::DeltaInfo &info,
+         unsigned long first, unsigned long last) {
+      std::vector<DeltaRun> runs;
+      unsigned long k = std::lower_bound(info.blocks.begin(),
+            info.blocks.end(), first / info.block_size) - info.blocks.begin();
+      while ((k < info.blocks.size()) &&
+            (info.block_first(info.blocks[k]) < last)) {
+         DeltaRun run;
+         run.k = k;
+         run.lo = std::max(first, info.block_first(info.blocks[k]));
+         while ((k + 1 < info.blocks.size()) &&
+               (info.blocks[k+1] == info.blocks[k] + 1) &&
+               (info.block_first(info.blocks[k+1]) < last)) {
+            k++;
+         }
+         run.hi = std::min(last, info.block_end(info.blocks[k]));
+         runs.push_back(run);
+         k++;
+      }
+      return runs;
+   }
+
+   // Find the blocks that changed since the output before this one (on all
+   // processors together)
+   Snapshot::DeltaInfo changed_blocks () {
+
+      Snapshot::DeltaInfo info;
+      const unsigned long first = ilo + Ng;
+      const unsigned long last = first + Nx_local;
+      const unsigned long size = delta_block;
+      const double tolerance = delta_tolerance;
+      std::vector<unsigned char> changed((Nx_global + size - 1) / size, 0);
+
+      for (unsigned int v = 0; v < n_vars; v++) {
+         const VarView q = data.view(v);
+         const double *reference = &delta_reference[v*Nx_local];
+         for (unsigned long b = first / size; b * size < last; b++) {
+            const unsigned long hi = std::min(last, (b + 1) * size);
+            for (unsigned long i = std::max(first, b * size);
+                  (i < hi) && !changed[b]; i++) {
+               changed[b] = delta_changed(q[i], reference[i-first],
+                     tolerance);
+            }
+         }
+      }
+#ifdef PARALLEL_MPI
+      MPI_Allreduce(MPI_IN_PLACE, changed.data(), changed.size(),
+            MPI_UNSIGNED_CHAR, MPI_MAX, MPI_COMM_WORLD);
+#endif // ifdef PARALLEL_MPI
+
+      info.time = Driver::time;
+      info.step = Driver::n_step;
+      info.n_cells = Nx_global;
+      info.base_step = delta_base_step;
+      info.full_step = delta_full_step;
+      info.block_size = size;
+      info.names = var_list;
+      for (unsigned long b = 0; b < changed.size(); b++) {
+         if (changed[b]) {
+            info.blocks.push_back(b);
+         }
+      }
+
+      return info;
+   }
+
+   // The number of blocks in the grid
+   unsigned long delta_n_blocks () {
+      return (Nx_global + delta_block - 1) / delta_block;
+   }
+
+   // The bytes of data a delta of the blocks in info would hold
+   std::size_t delta_data_bytes (const Snapshot::DeltaInfo &info) {
+      unsigned long n_stored = 0;
+      for (unsigned long k = 0; k < info.blocks.size(); k++) {
+         n_stored += info.block_end(info.blocks[k]) -
+            info.block_first(info.blocks[k]);
+      }
+      return n_vars * n_stored * sizeof(double);
+   }
+
+   // Write a delta of the blocks in info (from changed_blocks) against the
+   // output before it
+   std::string write_delta (Snapshot::DeltaInfo &info) {
+
+      // ----------------------------------------------------------------------
+      // Declare variables
+
+      std::stringstream ss;
+      const unsigned long first = ilo + Ng;
+      const unsigned long last = first + Nx_local;
+      std::vector<std::uint64_t> sums;
+      std::vector<DeltaRun> runs;
+      std::vector<char> header;
+      const std::string filename = chain_file_name(Driver::output_dir,
+            Driver::n_step, ".delta");
+
+      // ----------------------------------------------------------------------
+      // Take the changed blocks into the chain, and sum up the checksums of
+      // each stored block and of the whole grid as the chain now holds it
+
+      runs = local_runs(info, first, last);
+      sums.assign(info.blocks.size() + 1, 0);
+      for (unsigned int v = 0; v < n_vars; v++) {
+         const VarView q = data.view(v);
+         double *reference = &delta_reference[v*Nx_local];
+         for (unsigned int r = 0; r < runs.size(); r++) {
+            unsigned long k = runs[r].k;
+            for (unsigned long i = runs[r].lo; i < runs[r].hi; i++) {
+               k += (i == info.block_end(info.blocks[k])) ? 1 : 0;
+               reference[i-first] = q[i];
+               sums[k] += Snapshot::cell_checksum(i, v, q[i]);
+            }
+         }
+         for (unsigned long i = first; i < last; i++) {
+            sums.back() += Snapshot::cell_checksum(i, v, reference[i-first]);
+         }
+      }
+#ifdef PARALLEL_MPI
+      MPI_Allreduce(MPI_IN_PLACE, sums.data(), sums.size(), MPI_UINT64_T,
+            MPI_SUM, MPI_COMM_WORLD);
+#endif // ifdef PARALLEL_MPI
+      info.checksums.assign(sums.begin(), sums.end() - 1);
+      info.grid_checksum = sums.back();
+      header = Snapshot::encode_delta(info);
+
+      // ----------------------------------------------------------------------
+      // Write the output
+
+      // The header, then this processor's part of each run, array by array
+      // (in the order they are in the file)
+#ifdef PARALLEL_MPI
+      MPI_File fh;
+      MPI_Status status;
+      if (MPI_File_open(MPI_COMM_WORLD, (char *)filename.c_str(),
+               MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &fh) !=
+            MPI_SUCCESS) {
+         throw std::ios_base::failure("could not open " + filename);
+      }
+      MPI_File_set_size(fh, Snapshot::delta_file_size(info));
+      if (Driver::proc_ID == 0) {
+         MPI_File_write_at(fh, 0, &header[0], header.size(), MPI_CHAR,
+               &status);
+      }
+      auto put = [&] (std::size_t offset, double *values, unsigned long n) {
+         MPI_File_write_at(fh, offset, values, n, MPI_DOUBLE, &status);
+      };
+#else // ifdef PARALLEL_MPI
+      std::vector<char> padding;
+      std::ofstream fout(filename.c_str(), std::ios::binary | std::ios::trunc);
+      if (!fout) {
+         throw std::ios_base::failure("could not open " + filename);
+      }
+      fout.write(&header[0], header.size());
+      auto put = [&] (std::size_t offset, double *values, unsigned long n) {
+         padding.assign(offset - std::size_t(fout.tellp()), 0);
+         fout.write(padding.data(), padding.size());
+         fout.write((const char *)values, n * sizeof(double));
+      };
+#endif // ifdef PARALLEL_MPI
+      for (unsigned int v = 0; v < n_vars; v++) {
+         for (unsigned int r = 0; r < runs.size(); r++) {
+            const unsigned long k = runs[r].k;
+            put(info.offset(v, k) + (runs[r].lo -
+                     info.block_first(info.blocks[k])) * sizeof(double),
+                  &delta_reference[v*Nx_local + runs[r].lo - first],
+                  runs[r].hi - runs[r].lo);
+         }
+      }
+#ifdef PARALLEL_MPI
+      MPI_File_close(&fh);
+#else // ifdef PARALLEL_MPI
+      padding.assign(Snapshot::delta_file_size(info) -
+            std::size_t(fout.tellp()), 0);
+      fout.write(padding.data(), padding.size());
+      fout.close();
+      if (!fout) {
+         throw std::ios_base::failure("could not write " + filename);
+      }
+#endif // ifdef PARALLEL_MPI
+
+      delta_base_step = Driver::n_step;
+      deltas_written++;
+
+      ss << "OUTPUT : delta of " << info.blocks.size() << " of ";
+      ss << delta_n_blocks() << " blocks (";
+      ss << Snapshot::delta_file_size(info) << " bytes)" << std::endl;
+      Log::write_single(ss.str());
+
+      return filename;
+   }
+
+   // Write a shared snapshot or a delta, whichever is due
+   std::string write_chained () {
+
+      std::stringstream ss;
+      Snapshot::Info info;
+      std::string filename;
+      const int first = ilo + Ng;
+
+      if (!delta_reference.empty() && (deltas_written < delta_every)) {
+         Snapshot::DeltaInfo delta = changed_blocks();
+         if ((2 * delta.blocks.size() <= delta_n_blocks()) &&
+               (delta_data_bytes(delta) < delta_full_bytes)) {
+            return write_delta(delta);
+         }
+         ss << "OUTPUT : snapshot instead of a delta of ";
+         ss << delta.blocks.size() << " of " << delta_n_blocks();
+         ss << " blocks" << std::endl;
+         Log::write_single(ss.str());
+      }
+
+      // A full snapshot starts a new chain
+      info = snapshot_info();
+      filename = chain_file_name(Driver::output_dir, Driver::n_step, ".snap");
+      delta_full_bytes = write_snapshot(filename, info);
+      delta_reference.resize(n_vars * Nx_local);
+      for (unsigned int v = 0; v < n_vars; v++) {
+         const VarView q = data.view(v);
+         for (unsigned int i = 0; i < Nx_local; i++) {
+            delta_reference[v*Nx_local + i] = q[first+i];
+         }
+      }
+      delta_base_step = Driver::n_step;
+      delta_full_step = Driver::n_step;
+      deltas_written = 0;
+
+      return filename;
+   }
+
+   // Read the header and tables of a delta (processor 0 reads them and
+   // passes them on)
+   Snapshot::DeltaInfo read_delta_info (const std::string &filename) {
+
+      std::vector<char> header(sizeof(Snapshot::DeltaHeader));
+      std::string problem;
+      unsigned long n = 0;
+
+#ifdef PARALLEL_MPI
+      if (Driver::proc_ID == 0) {
+#endif // ifdef PARALLEL_MPI
+         try {
+            std::ifstream fin(filename.c_str(), std::ios::binary);
+            fin.read(&header[0], header.size());
+            if (fin) {
+               header.resize(Snapshot::delta_header_size(&header[0],
+                        header.size()));
+               fin.read(&header[sizeof(Snapshot::DeltaHeader)],
+                     header.size() - sizeof(Snapshot::DeltaHeader));
+            }
+            n = fin ? header.size() : 0;
+         } catch (std::exception &e) {
+            problem = e.what();
+         }
+#ifdef PARALLEL_MPI
+      }
+      MPI_Bcast(&n, 1, MPI_UNSIGNED_LONG, 0, MPI_COMM_WORLD);
+      header.resize(n);
+      if (n > 0) {
+         MPI_Bcast(&header[0], n, MPI_CHAR, 0, MPI_COMM_WORLD);
+      }
+#endif // ifdef PARALLEL_MPI
+      if (n == 0) {
+         throw std::ios_base::failure("could not read " + filename +
+               (problem.empty() ? "" : " (" + problem + ")"));
+      }
+      return Snapshot::decode_delta(&header[0], header.size());
+   }
+
+   // Apply a delta to the grid (which must hold the output it is based on)
+   void apply_delta (const std::string &filename,
+         const Snapshot::DeltaInfo &info) {
+
+      // ----------------------------------------------------------------------
+      // Declare variables
+
+      std::vector<int> idx(n_vars);
+      std::vector<double> buffer;
+      std::vector<std::uint64_t> sums(info.blocks.size() + 1, 0);
+      const unsigned long first = ilo + Ng;
+      const unsigned long last = first + Nx_local;
+      const std::vector<DeltaRun> runs = local_runs(info, first, last);
+
+      // ----------------------------------------------------------------------
+      // Check the delta
+
+      if (info.n_cells != Nx_global) {
+         throw std::length_error("length of file does not match Grid");
+      }
+      if (info.base_step != Driver::n_step) {
+         throw std::runtime_error(filename + " does not follow the output "
+               "of the step before it in the chain");
+      }
+      if (info.names.size() != n_vars) {
+         throw std::out_of_range("variables of delta do not match Grid");
+      }
+      for (unsigned int v = 0; v < n_vars; v++) {
+         idx[v] = std::find(info.names.begin(), info.names.end(),
+               var_list[v]) - info.names.begin();
+         if (idx[v] == int(n_vars)) {
+            throw std::out_of_range("variable missing from data file");
+         }
+      }
+
+      // ----------------------------------------------------------------------
+      // Read this processor's cells of the stored blocks
+
+#ifdef PARALLEL_MPI
+      MPI_File fh;
+      MPI_Status status;
+      if (MPI_File_open(MPI_COMM_WORLD, (char *)filename.c_str(),
+               MPI_MODE_RDONLY, MPI_INFO_NULL, &fh) != MPI_SUCCESS) {
+         throw std::ios_base::failure("could not open " + filename);
+      }
+#else // ifdef PARALLEL_MPI
+      std::ifstream fin(filename.c_str(), std::ios::binary);
+#endif // ifdef PARALLEL_MPI
+      for (unsigned int v = 0; v < n_vars; v++) {
+         const VarView q = data.view(v);
+         for (unsigned int r = 0; r < runs.size(); r++) {
+            unsigned long k = runs[r].k;
+            const std::size_t offset = info.offset(idx[v], k) +
+               (runs[r].lo - info.block_first(info.blocks[k])) *
+               sizeof(double);
+            buffer.resize(runs[r].hi - runs[r].lo);
+#ifdef PARALLEL_MPI
+            MPI_File_read_at(fh, offset, buffer.data(), buffer.size(),
+                  MPI_DOUBLE, &status);
+#else // ifdef PARALLEL_MPI
+            fin.seekg(offset);
+            fin.read((char *)buffer.data(), buffer.size() * sizeof(double));
+#endif // ifdef PARALLEL_MPI
+            for (unsigned long i = runs[r].lo; i < runs[r].hi; i++) {
+               k += (i == info.block_end(info.blocks[k])) ? 1 : 0;
+               q[i] = buffer[i - runs[r].lo];
+               sums[k] += Snapshot::cell_checksum(i, idx[v], q[i]);
+            }
+         }
+         for (unsigned long i = first; i < last; i++) {
+            sums.back() += Snapshot::cell_checksum(i, idx[v], q[i]);
+         }
+      }
+#ifdef PARALLEL_MPI
+      MPI_File_close(&fh);
+      MPI_Allreduce(MPI_IN_PLACE, sums.data(), sums.size(), MPI_UINT64_T,
+            MPI_SUM, MPI_COMM_WORLD);
+#else // ifdef PARALLEL_MPI
+      if (!fin) {
+         throw std::ios_base::failure("could not read " + filename);
+      }
+#endif // ifdef PARALLEL_MPI
+
+      // ----------------------------------------------------------------------
+      // Check the checksums
+
+      for (unsigned long k = 0; k < info.blocks.size(); k++) {
+         if (sums[k] != info.checksums[k]) {
+            throw std::runtime_error(filename + " is damaged (a block does "
+                  "not match its checksum)");
+         }
+      }
+      if (sums.back() != info.grid_checksum) {
+         throw std::runtime_error("the grid rebuilt from " + filename +
+               " does not match its checksum (is the chain broken?)");
+      }
+
+      Driver::time = info.time;
+      Driver::n_step = info.step;
+   }
+
+   // Rebuild the grid at the step of a delta, from its chain
+   void read_chain (const std::string &filename) {
+
+      std::stringstream ss;
+      std::string dir = fs::path(filename).parent_path().string();
+      std::vector<std::string> names(1, filename);
+      std::vector<Snapshot::DeltaInfo> chain(1, read_delta_info(filename));
+
+      // Follow the chain back to its snapshot, then forward again
+      dir += dir.empty() ? "" : "/";
+      while (chain.back().base_step != chain.back().full_step) {
+         names.push_back(chain_file_name(dir, chain.back().base_step,
+                  ".delta"));
+         chain.push_back(read_delta_info(names.back()));
+      }
+      read_shared(chain_file_name(dir, chain.back().full_step, ".snap"));
+      for (unsigned int k = chain.size(); k-- > 0; ) {
+         apply_delta(names[k], chain[k]);
+      }
+
+      ss << "Applied " << chain.size() << " delta";
+      ss << ((chain.size() > 1) ? "s" : "") << ", up to step ";
+      ss << Driver::n_step << " and time " << Driver::time << ".\n\n";
+      Log::write_single(ss.str());
+   }
+
+   // =========================================================================
+   // Write the data to a file
 
-   // Array of coordinates
-   CellVar x;
+   std::string write_data () {
 
-   // Data grid
-   CellVar data;
+      if (output_format == "shared") {
+         return (delta_every > 0) ? write_chained() : write_shared();
+      }
 
-   // Indices of arrays
-   DelayedConst<int> ilo, ihi; // arrays include indices ilo to ihi-1
+      // ----------------------------------------------------------------------
+      // Declare variables
 
-   // The processor IDs of the lower and upper neighbors
-   DelayedConst<int> neigh_lo, neigh_hi;
+      std::stringstream ss;
+      std::string dirname;
 
-   std::vector<std::string> var_list;
-   DelayedConst<unsigned int> n_vars;
+      // ----------------------------------------------------------------------
+      // Write the output
 
-   // Output precision
-   const unsigned int w = 30;
+      // The subdirectory for the current output (made by whoever writes
+      // into it)
+      ss.clear();
+      ss.str("");
+      ss << std::setfill('0') << std::setw(Driver::n_width) << Driver::n_step;
+      ss >> dirname;
+      dirname = Driver::output_dir + "step_" + dirname;
 
-   // =========================================================================
-   // Add a new variable to the Grid
+      // The index of the data files (see read_data)
+      write_index(dirname);
 
-   unsigned int add_variable(std::string new_var) {
-      for (unsigned int i = 0; i < var_list.size(); i++) {
-         if (var_list[i] == new_var) {
-            return i;
+      // With aggregation, only the first processor of each group writes
+      bool writes = true;
+#ifdef PARALLEL_MPI
+      writes = (aggregators_per_node == 0) || (io_rank == 0);
+#endif // ifdef PARALLEL_MPI
+
+      // Write the files, or hand them to the I/O thread or a child process
+      if (async_output && writes) {
+         unsigned int f = take_frame();
+         capture_frame(frames[f], dirname);
+         to_writer->push(f);
+      } else if (async_output || !fork_output) {
+         OutputFrame frame;
+         capture_frame(frame, dirname);
+         if (writes) {
+            emit_frame(frame, Threads::threads_for(frame.n_cells));
          }
+      } else if (fork_writer(dirname)) {
+         // The child copies the cells from its own image of the grid
+         child_write([&] {
+            OutputFrame frame;
+            capture_frame(frame, dirname);
+            emit_frame(frame);
+         });
       }
-      var_list.push_back(new_var);
-      return var_list.size() - 1;
+
+      return dirname;
+
    }
 
    // =========================================================================
-   // Set up
+   // Load data from a file
+   //    A text restart is read from the data files of a step directory.
+   // Each step directory also holds an index (index.txt) of the cells in
+   // each data file and where their lines start, so that every processor can
+   // read just the lines of its own cells, from however many files hold
+   // them.  With an index, a run can restart on any number of processors.
+   // Without one (older output), each processor reads the file it wrote.  A
+   // shared snapshot can be read by any number of processors too.
 
-   void setup () {
+   // =========================================================================
+   // Fast text restart
+   //    The data file of a text restart is mapped into memory and parsed in
+   // place with std::from_chars, straight into the grid.  The lines are
+   // split into one part per thread; a first pass counts the lines of each
+   // part (which gives the cell each part starts at), and a second parses
+   // them.  std::from_chars rounds correctly, so the values are the same as
+   // those read with a stream.
+
+   // A file mapped into memory (read-only)
+   class MappedFile {
+
+      public:
+
+         explicit MappedFile (const std::string &filename)
+               : base(NULL), length(0) {
+            struct stat st;
+            int fd = open(filename.c_str(), O_RDONLY);
+            if (fd < 0) {
+               throw std::ios_base::failure("could not open " + filename);
+            }
+            if (fstat(fd, &st) != 0) {
+               close(fd);
+               throw std::ios_base::failure("could not read " + filename);
+            }
+            length = st.st_size;
+            if (length > 0) {
+               void *p = mmap(NULL, length, PROT_READ, MAP_SHARED, fd, 0);
+               if (p == MAP_FAILED) {
+                  close(fd);
+                  throw std::ios_base::failure("could not map " + filename);
+               }
+               base = (const char *)p;
+               madvise(p, length, MADV_SEQUENTIAL);
+            }
+            close(fd);
+         }
 
-      std::stringstream ss;
+         ~MappedFile () {
+            if (length > 0) {
+               munmap((void *)base, length);
+            }
+         }
 
-      Log::write_single(std::string(79,'_') + "\n");
-      Log::write_single("Grid Setup:\n\n");
+         const char* begin () const {
+            return base;
+         }
 
-      // ----------------------------------------------------------------------
-      // Get parameters
+         const char* end () const {
+            return base + length;
+         }
 
-      // Number of guard cells
-      Ng = fmax(1, Hydro::min_guard);
+         std::size_t size () const {
+            return length;
+         }
 
-      // Number of internal cells
-      Nx_global = Parameters::get_required<unsigned int>("Grid.Nx");
+      private:
 
-      // Limits
-      xmin = Parameters::get_required<double>("Grid.xmin");
-      xmax = Parameters::get_required<double>("Grid.xmax");
+         MappedFile (const MappedFile &);
+         MappedFile& operator= (const MappedFile &);
 
-      // ----------------------------------------------------------------------
-      // Set up grid
+         const char *base;
+         std::size_t length;
+   };
 
-      // Coordinates
-      dx = (xmax - xmin) / Nx_global;
+   // The end of the line that starts at p (its newline, or end), and the
+   // start of the next line
+   inline const char* line_end (const char *p, const char *end) {
+      const char *newline = (const char *)std::memchr(p, '\n', end - p);
+      return (newline != NULL) ? newline : end;
+   }
 
-#ifdef PARALLEL_MPI
-      // Determine neighbors
-      if (Driver::proc_ID == 0) {
-         neigh_lo = Driver::n_procs - 1;
-      } else {
-         neigh_lo = Driver::proc_ID - 1;
+   inline const char* next_line (const char *p, const char *end) {
+      const char *e = line_end(p, end);
+      return (e < end) ? e + 1 : end;
+   }
+
+   inline bool is_blank (const char *p, const char *end) {
+      for (; p < end; p++) {
+         if (!std::isspace((unsigned char)*p)) {
+            return false;
+         }
       }
-      if (Driver::proc_ID == Driver::n_procs - 1) {
-         neigh_hi = 0;
-      } else {
-         neigh_hi = Driver::proc_ID + 1;
+      return true;
+   }
+
+   // Split begin to end into n parts of about the same size, each starting
+   // at the beginning of a line; part t is parts[t] to parts[t+1]
+   std::vector<const char *> split_lines (const char *begin, const char *end,
+         unsigned int n) {
+      std::vector<const char *> parts(n + 1, end);
+      parts[0] = begin;
+      for (unsigned int t = 1; t < n; t++) {
+         const char *p = begin + (end - begin) * t / n;
+         if (p <= parts[t-1]) {
+            p = parts[t-1];
+         } else if (p[-1] != '\n') {
+            p = next_line(p, end);
+         }
+         parts[t] = p;
       }
-      // Print a summary of neighbors
-      ss << "MPI Neighbors : < " << neigh_lo << " | " << Driver::proc_ID;
-      ss << " | " << neigh_hi << " >" << std::endl;
-      Log::write_all(ss.str());
-      Log::write_single("\n");
+      return parts;
+   }
 
-      // Compute limits
-      ilo = (Nx_global *  Driver::proc_ID   ) / Driver::n_procs - Ng;
-      ihi = (Nx_global * (Driver::proc_ID+1)) / Driver::n_procs + Ng;
-      // Compute size
-      Nx_local = ihi - ilo - 2*Ng;
-#else // PARALLEL_MPI
-      // Compute limits
-      ilo = 0         - Ng;
-      ihi = Nx_global + Ng;
-      // Compute size
-      Nx_local = Nx_global;
-#endif // end ifdef PARALLEL_MPI
-      // Verify Nx_local >= Ng or the communication becomes absurd
-      if (Nx_local < Ng) {
-         throw std::length_error("The number of local internal cells must exceed the number of guard cells");
+   // The data lines of a file (or a part of one), split into one part per
+   // thread
+   struct TextParts {
+      std::vector<const char *> parts;       // part t: parts[t] to parts[t+1]
+      std::vector<unsigned long> first_line; // lines before each part
+      unsigned long n_lines () const {
+         return first_line.back();
       }
-      // Fill the coordinates
-      x.init();
-      for (int i = ilo; i < ihi; i++) {
-         x(i) = xmin + dx * (i + 0.5);
+      unsigned int n_parts () const {
+         return parts.size() - 1;
       }
-
-      // Set up the grid
-      Hydro::add_variables();
-      InitConds::add_variables();
-      /* Add add_variables() for any other components that want variables. */
-      n_vars = var_list.size();
-      data.init(n_vars);
-
-      ss.clear();
-      ss.str("");
-      ss << "Simulating with " << n_vars << " variables:" << std::endl;
-      Log::write_single(ss.str());
-      unsigned int v_width = fmax(floor(log10(n_vars)) + 1, 2);
-      for (unsigned int v = 0; v < n_vars; v++) {
-         ss.clear();
-         ss.str("");
-         ss << "  ";
-         ss << std::setfill('0') << std::setw(v_width) << v;
-         ss << " : " << var_list[v] << std::endl;
-         Log::write_single(ss.str());
+   };
+
+   // The number of data lines from p to end
+   unsigned long count_lines (const char *p, const char *end) {
+      unsigned long n = 0;
+      while (p < end) {
+         const char *e = line_end(p, end);
+         n += is_blank(p, e) ? 0 : 1;
+         p = (e < end) ? e + 1 : end;
       }
-      Log::write_single("\n");
+      return n;
    }
 
-   // =========================================================================
-   // Clean up
-
-   void cleanup () {
-      // Does nothing; the grids will call their destructors when they go out
-      // of scope, and nothing else needs to be done here.
+   // Split the lines from begin to end into parts, and count the lines in
+   // each part (which gives the cell each part starts at)
+   TextParts count_text (const char *begin, const char *end) {
+      TextParts text;
+      unsigned int n_parts = (end - begin) / (1 << 16);
+      n_parts = (n_parts < Threads::n_threads) ? n_parts : Threads::n_threads;
+      n_parts = (n_parts > 0) ? n_parts : 1;
+      text.parts = split_lines(begin, end, n_parts);
+      text.first_line.assign(n_parts + 1, 0);
+      Threads::run(n_parts, [&] (unsigned int t) {
+            text.first_line[t+1] = count_lines(text.parts[t],
+                  text.parts[t+1]);
+         });
+      for (unsigned int t = 0; t < n_parts; t++) {
+         text.first_line[t+1] += text.first_line[t];
+      }
+      return text;
    }
 
-   // =========================================================================
-   // Fill boundary conditions
-
-   void fill_boundary_conditions() {
-#ifdef PARALLEL_MPI
-      // Declare some variables
-      MPI_Request requests[4];   // Two sends and two receives (1 up, 1 down)
-      MPI_Status  statuses[4];   // Statuses of sends/receives
-      unsigned int n_trans = Ng * n_vars;
-      double lo_recv[n_trans], hi_recv[n_trans];
-      double lo_send[n_trans], hi_send[n_trans];
-      int pass_up = 1;
-      int pass_down = 2;
-      int mpi_return;
-      // Pack the send buffers
-      for (int i = 0; i < Ng; i++) {
-         for (unsigned int v = 0; v < n_vars; v++) {
-            try {
-               lo_send[i*n_vars+v] = data(ilo+i+Ng,  v);
-               hi_send[i*n_vars+v] = data(ihi+i-Ng*2,v);
-            } catch (...) {
-               std::cerr << "Error packing send buffers";
-               std::cerr << " in fill_boundary_conditions" << std::endl;
-               throw;
+   // Parse the data lines from p to end (each a position and one value per
+   // column) into cells i, i+1, ...; returns an error message, or nothing
+   std::string parse_lines (const char *p, const char *end, int i,
+         const std::vector<VarView> &columns) {
+      const VarView xv = x.view();
+      double value;
+      while (p < end) {
+         const char *e = line_end(p, end);
+         if (!is_blank(p, e)) {
+            for (unsigned int c = 0; c <= columns.size(); c++) {
+               while ((p < e) && std::isspace((unsigned char)*p)) {
+                  p++;
+               }
+               const std::from_chars_result r = std::from_chars(p, e, value);
+               if (r.ec != std::errc()) {
+                  std::stringstream ss;
+                  ss << "not enough values for cell " << i;
+                  return ss.str();
+               }
+               p = r.ptr;
+               if (c == 0) {
+                  xv[i] = value;
+               } else {
+                  columns[c-1][i] = value;
+               }
+            }
+            if (!is_blank(p, e)) {
+               std::stringstream ss;
+               ss << "too many values for cell " << i;
+               return ss.str();
             }
+            i++;
          }
+         p = (e < end) ? e + 1 : end;
       }
-      // Asynchronous receives
-      MPI_Irecv(&lo_recv, n_trans, MPI_DOUBLE, neigh_lo, pass_up,
-            MPI_COMM_WORLD, &requests[0]);
-      MPI_Irecv(&hi_recv, n_trans, MPI_DOUBLE, neigh_hi, pass_down,
-            MPI_COMM_WORLD, &requests[1]);
-      // Asynchronous sends
-      MPI_Isend(&lo_send, n_trans, MPI_DOUBLE, neigh_lo, pass_down,
-            MPI_COMM_WORLD, &requests[2]);
-      MPI_Isend(&hi_send, n_trans, MPI_DOUBLE, neigh_hi, pass_up,
-            MPI_COMM_WORLD, &requests[3]);
-      // Wait for sends and receives to finish
-      mpi_return = MPI_Waitall(4, requests, statuses);
-      if (mpi_return != MPI_SUCCESS) {
-         std::cerr << "boundary condition/guard cell fill failed";
-         std::cerr << std::endl;
-         MPI_Abort(MPI_COMM_WORLD, mpi_return);
+      return "";
+   }
+
+   // Parse the counted lines into cells cell, cell+1, ...
+   void parse_text (const TextParts &text, int cell,
+         const std::vector<VarView> &columns) {
+      const unsigned int n_parts = text.n_parts();
+      std::vector<std::string> errors(n_parts);
+      Threads::run(n_parts, [&] (unsigned int t) {
+            errors[t] = parse_lines(text.parts[t], text.parts[t+1],
+                  cell + text.first_line[t], columns);
+         });
+      for (unsigned int t = 0; t < n_parts; t++) {
+         if (!errors[t].empty()) {
+            throw std::length_error(errors[t]);
+         }
       }
-      // Unpack receive buffers
-      for (int i = 0; i < Ng; i++) {
+   }
+
+   // The names of the columns are in comment lines at the top of a data file
+   // (the position, which is not a variable, and then the variables); get
+   // the variable of each column, and return the start of the first data line
+   const char* read_columns (const char *p, const char *end,
+         std::vector<unsigned int> &var_of_column) {
+      var_of_column.clear();
+      while (p < end) {
+         const char *e = line_end(p, end);
+         const char *hash = (const char *)std::memchr(p, '#', e - p);
+         if (hash == NULL) {
+            break;
+         }
+         std::stringstream name_ss(std::string(hash + 1, e));
+         std::string name;
+         name_ss >> name;
          for (unsigned int v = 0; v < n_vars; v++) {
-            try{
-               data(ilo+i   ,v) = lo_recv[i*n_vars+v];
-               data(ihi+i-Ng,v) = hi_recv[i*n_vars+v];
-            } catch (...) {
-               std::cerr << "Error unpacking receive buffers";
-               std::cerr << " in fill_boundary_conditions" << std::endl;
-               throw;
+            if (var_list[v] == name) {
+               var_of_column.push_back(v);
+               break;
             }
          }
+         p = next_line(p, end);
       }
-#else // ifdef PARALLEL_MPI
-      for (int i = 0; i < Ng; i++) {
-         for (unsigned int v = 0; v < n_vars; v++) {
-            data(ilo   +i,v) = data(ihi-Ng*2+i,v);
-            data(ihi-Ng+i,v) = data(ilo+Ng  +i,v);
+      for (unsigned int v = 0; v < n_vars; v++) {
+         if (std::find(var_of_column.begin(), var_of_column.end(), v) ==
+               var_of_column.end()) {
+            throw std::out_of_range("variable missing from data file");
          }
       }
-#endif // ifdef PARALLEL_MPI
+      return p;
    }
 
-   // =========================================================================
-   // Write the data to a file
-
-   std::string write_data () {
-
-      // ----------------------------------------------------------------------
-      // Declare variables
+   // Where the values of each column go
+   std::vector<VarView> column_views (
+         const std::vector<unsigned int> &var_of_column) {
+      std::vector<VarView> columns;
+      for (unsigned int c = 0; c < var_of_column.size(); c++) {
+         columns.push_back(data.view(var_of_column[c]));
+      }
+      return columns;
+   }
 
+   // Log how fast the restart was read, and the most threads (parts of the
+   // text read at once) any processor used
+   void log_restart_rate (double megabytes, double seconds,
+         unsigned int n_parts) {
       std::stringstream ss;
-      std::string dirname, filename;
-      std::ofstream fout;
-
-      // ----------------------------------------------------------------------
-      // Write the output
-
-      // Create the subdirectory for the current output
-      ss.clear();
-      ss.str("");
-      ss << std::setfill('0') << std::setw(Driver::n_width) << Driver::n_step;
-      ss >> dirname;
-      dirname = Driver::output_dir + "step_" + dirname;
 #ifdef PARALLEL_MPI
-      if (Driver::proc_ID == 0) {
-#endif // ifdef PARALLEL_MPI
-         if (fs::exists(dirname)) { // Remove existing folder with same name
-            fs::remove_all(fs::path(dirname));
+      MPI_Allreduce(MPI_IN_PLACE, &megabytes, 1, MPI_DOUBLE, MPI_SUM,
+            MPI_COMM_WORLD);
+      MPI_Allreduce(MPI_IN_PLACE, &seconds, 1, MPI_DOUBLE, MPI_MAX,
+            MPI_COMM_WORLD);
+      MPI_Allreduce(MPI_IN_PLACE, &n_parts, 1, MPI_UNSIGNED, MPI_MAX,
+            MPI_COMM_WORLD);
+#endif // PARALLEL_MPI
+      ss << "Restart: read " << std::setprecision(3) << megabytes;
+      ss << " MB of text in " << seconds << " s (";
+      ss << megabytes / seconds << " MB/s, " << n_parts;
+      ss << " thread" << ((n_parts > 1) ? "s" : "");
+      ss << " per processor)" << std::endl;
+      Log::write_single(ss.str());
+   }
+
+   // Read the index of the restart directory (and check that its files hold
+   // every cell once, in order)
+   std::vector<IndexEntry> read_index (const std::string &filename) {
+      std::vector<IndexEntry> index;
+      std::ifstream fin(filename.c_str());
+      std::string line;
+      unsigned long next = 0;
+      while (std::getline(fin, line)) {
+         if (line.find('#') != std::string::npos) {
+            continue;
+         }
+         std::istringstream iss(line);
+         IndexEntry entry;
+         if (iss >> entry.file >> entry.first >> entry.count >>
+               entry.data_offset >> entry.line_bytes) {
+            if (entry.first != next) {
+               throw std::length_error("restart index has a gap or overlap");
+            }
+            next += entry.count;
+            index.push_back(entry);
          }
-         fs::create_directories(dirname);    // Create the new directory
-#ifdef PARALLEL_MPI
       }
-      // Sync to ensure directory exist before writing begins
-      MPI_Barrier(MPI_COMM_WORLD);
-#endif // ifdef PARALLEL_MPI
+      if (next != Nx_global) {
+         throw std::length_error("length of restart index does not match "
+               "Grid");
+      }
+      return index;
+   }
 
-      // Write the important header information
-      filename = dirname + "/header.txt";
-      fout.open(filename.c_str());
-      fout << "time        = " << Driver::time << std::endl;
-      fout << "step        = " << Driver::n_step << std::endl;
-      fout.close();
+   // Read this processor's cells from the files of the index
+   void read_indexed (const std::vector<IndexEntry> &index) {
+
+      Clock::time_point t_start = Clock::now();
+      double bytes = 0.0;
+      unsigned int n_parts = 1;
+      std::vector<unsigned int> var_of_column;
 
-      // Write the data
 #ifdef PARALLEL_MPI
-      ss.str("");
-      ss.clear();
-      ss << std::setfill('0') << std::setw(Driver::p_width) << Driver::proc_ID;
-      ss >> filename;
-      filename = dirname + "/grid_" + filename + ".dat";
-#else // PARALLEL_MPI
-      filename = dirname + "/grid.dat";
-#endif // PARALLEL_MPI
-      fout.open(filename.c_str());
-      fout << "# position" << std::endl;
-      for (unsigned int v = 0; v < n_vars; v++) {
-         fout << "# " << var_list[v] << std::endl;
-      }
-      fout.precision(w-8);
-      fout.setf(std::ios::scientific);
-      for (int i = ilo+Ng; i < ihi-Ng; i++) {
-         fout << std::setw(w) << x(i);
-         for (unsigned int v = 0; v < n_vars; v++) {
-            fout << "   " << std::setw(w) << data(i,v);
+      // Written by as many processors as there are now: keep their cells,
+      // which may have been rebalanced (the same choice on every processor)
+      if (index.size() == (unsigned int)Driver::n_procs) {
+         const IndexEntry &own = index[Driver::proc_ID];
+         bool usable = true;
+         for (unsigned int f = 0; f < index.size(); f++) {
+            usable = usable && (index[f].count >= Ng);
+         }
+         if (usable && ((own.first != (unsigned long)(ilo + Ng)) ||
+                  (own.count != Nx_local))) {
+            set_local_cells(own.first, own.first + own.count);
+            Log::write_single("(cells distributed as in the restart files)\n");
          }
-         fout << std::endl;
+      } else {
+         std::stringstream ss;
+         ss << "(redistributing " << Nx_global << " cells from ";
+         ss << index.size() << " files to " << Driver::n_procs;
+         ss << " processors)" << std::endl;
+         Log::write_single(ss.str());
       }
-      fout.close();
+#endif // PARALLEL_MPI
 
-      return dirname;
+      // The lines of this processor's cells in each file that has some
+      const unsigned long lo = ilo + Ng, hi = lo + Nx_local;
+      for (unsigned int f = 0; f < index.size(); f++) {
+         const IndexEntry &entry = index[f];
+         const unsigned long a = std::max(lo, entry.first);
+         const unsigned long b = std::min(hi, entry.first + entry.count);
+         if (a >= b) {
+            continue;
+         }
+         const std::string filename = Driver::restart_dir + entry.file;
+         MappedFile file(filename);
+         const char *begin = read_columns(file.begin(), file.end(),
+               var_of_column);
+         const char *end;
+         if ((std::size_t(begin - file.begin()) > entry.data_offset) ||
+               (entry.data_offset > file.size())) {
+            throw std::length_error(filename + " does not match the index");
+         }
+         begin = file.begin() + entry.data_offset;
+         if (entry.line_bytes > 0) {
+            // Straight to the lines
+            if (entry.data_offset + (b - entry.first) * entry.line_bytes >
+                  file.size()) {
+               throw std::length_error(filename + " is too short");
+            }
+            begin += (a - entry.first) * entry.line_bytes;
+            end = begin + (b - a) * entry.line_bytes;
+         } else {
+            // Step over the lines
+            for (unsigned long i = entry.first; i < a; i++) {
+               begin = next_line(begin, file.end());
+            }
+            end = begin;
+            for (unsigned long i = a; i < b; i++) {
+               end = next_line(end, file.end());
+            }
+         }
+         // (which must be whole lines)
+         const TextParts text = count_text(begin, end);
+         if ((text.n_lines() != b - a) || (begin[-1] != '\n') ||
+               ((end[-1] != '\n') && (end != file.end()))) {
+            throw std::length_error(filename + " does not match the index");
+         }
+         parse_text(text, a, column_views(var_of_column));
+         bytes += end - begin;
+         n_parts = std::max(n_parts, text.n_parts());
+      }
 
+      log_restart_rate(bytes / 1.0e6, Seconds(Clock::now() - t_start).count(),
+            n_parts);
    }
 
-   // =========================================================================
-   // Load data from a file
-
-   // TODO --- allow redistribution to a different number of cores
-   // New read:
-   // - generate a list of files
-   //   - list all files matching Driver::restart_dir + "grid*.dat" (catches
-   //     either grid.dat or all of grid_######.dat --- shouldn't have both
-   //     cases in one file or something is very wrong, but it will fail on the
-   //     check for x[i] = x_vector[i] below)
-   // - for each file in the list
-   //   - open the file
-   //   - read in the positions and the data row for the position and append to
-   //     vectors of position (as double) and data (as std::string)
-   // - verify you have the correct total number of cells
-   // - sort the two vectors using the position as the key (low x -> low i)
-   // - check positions: x[i] = x_vector[i] (accounting for finite precision)
-   // - process data lines ilo:ihi into cells ilo:ihi
+   // -------------------------------------------------------------------------
+   // Read the restart
 
    void read_data() {
 
@@ -344,12 +2729,21 @@ namespace Grid {
       std::string line_key, line_val;
       std::ifstream fin;
       std::stringstream ss;
-      int i;
-      double xin, din;
-      std::vector< std::vector<double> > data_vec;
-      std::vector<double> x_vec, data_row;
-      std::vector<unsigned int> idx_map(n_vars, -1);
-      unsigned int var_idx = 0;
+      std::vector<unsigned int> var_of_column;
+      Clock::time_point t_start;
+
+      // A single file is a shared snapshot or a delta
+      if (fs::is_regular_file(Driver::restart_dir)) {
+         char magic[8];
+         fin.open(Driver::restart_dir.c_str(), std::ios::binary);
+         fin.read(magic, sizeof(magic));
+         if (Snapshot::is_delta(magic, fin.gcount())) {
+            read_chain(Driver::restart_dir);
+         } else {
+            read_shared(Driver::restart_dir);
+         }
+         return;
+      }
 
       // Process the header file ----------------------------------------------
 
@@ -387,6 +2781,12 @@ namespace Grid {
 
       // Load the data file ---------------------------------------------------
 
+      // With an index, read the lines of this processor's cells
+      if (fs::exists(Driver::restart_dir + "index.txt")) {
+         read_indexed(read_index(Driver::restart_dir + "index.txt"));
+         return;
+      }
+
       // Get the name of the data file
 #ifdef PARALLEL_MPI
       // Loop over all files in restart_dir to find one that matches
@@ -423,62 +2823,59 @@ namespace Grid {
       }
 #endif // PARALLEL_MPI
 
-      // Open the data file
-      fin.open(filename.c_str());
-
-      // Process the data file
-      var_idx = 0;
-      while (std::getline(fin, line)) {
-         pos = line.find('#');
-         if (pos != std::string::npos) {
-            // Comment line
-            line = line.substr(pos+2);
-            for (unsigned int v = 0; v < n_vars; v++) {
-               if (var_list[v] == line) {
-                  idx_map[v] = var_idx;
-                  var_idx++;
-                  break;
-               }
-            }
-         } else {
-            // Data line
-            std::istringstream iss(line);
-            iss >> xin;
-            while (iss >> din) {
-               data_row.push_back(din);
-            }
-            x_vec.push_back(xin);
-            data_vec.push_back(data_row);
-            data_row.clear();
-         }
-      }
-
-      // Close the data file
-      fin.close();
+      // Map the data file and count its cells
+      t_start = Clock::now();
+      MappedFile file(filename);
+      const char *begin = read_columns(file.begin(), file.end(),
+            var_of_column);
+      const TextParts text = count_text(begin, file.end());
+      const unsigned long n_lines = text.n_lines();
 
       // Store to Grid --------------------------------------------------------
 
-      if (x_vec.size() == Nx_local) {
-         for (int i = 0; i < Nx_local; i++) {
-            x(ilo+Ng+i)    = x_vec[i];
-            if (data_vec[i].size() == n_vars) {
-               for (unsigned int v = 0; v < n_vars; v++) {
-                  data(ilo+Ng+i,idx_map[v]) = data_vec[i][v];
-               }
-            } else {
-               std::stringstream ss;
-               ss << "not enough values for cell " << i << std::endl;
-               throw std::length_error(ss.str());
-            }
+#ifdef PARALLEL_MPI
+      // The files may come from a run that rebalanced its cells: if the cells
+      // in them add up to the whole grid, take the limits from the files
+      {
+         int count = n_lines;
+         int start = 0, total = 0;
+         bool usable = true;
+         std::vector<int> counts(Driver::n_procs);
+         MPI_Allgather(&count, 1, MPI_INT, &counts[0], 1, MPI_INT,
+               MPI_COMM_WORLD);
+         for (int r = 0; r < Driver::n_procs; r++) {
+            start += (r < Driver::proc_ID) ? counts[r] : 0;
+            total += counts[r];
+            usable = usable && (counts[r] >= int(Ng));
          }
-      } else {
-         std::cerr << Driver::proc_ID << " file contains " << x_vec.size();
+         if (usable && (total == int(Nx_global)) &&
+               ((start != ilo + int(Ng)) || (count != int(Nx_local)))) {
+            set_local_cells(start, start + count);
+            Log::write_single("(cells distributed as in the restart files)\n");
+         }
+      }
+#endif // PARALLEL_MPI
+
+      if (n_lines != Nx_local) {
+#ifdef PARALLEL_MPI
+         std::cerr << Driver::proc_ID << " ";
+#endif // PARALLEL_MPI
+         std::cerr << "file contains " << n_lines;
          std::cerr << " cells" << std::endl;
-         std::cerr << Driver::proc_ID << " code expects  " << Nx_local;
+#ifdef PARALLEL_MPI
+         std::cerr << Driver::proc_ID << " ";
+#endif // PARALLEL_MPI
+         std::cerr << "code expects  " << Nx_local;
          std::cerr << " cells" << std::endl;
          throw std::length_error("length of file does not match Grid");
       }
 
+      // Parse each part straight into its cells
+      parse_text(text, ilo + Ng, column_views(var_of_column));
+
+      log_restart_rate(file.size() / 1.0e6,
+            Seconds(Clock::now() - t_start).count(), text.n_parts());
+
    }
 
 }
@@ -4,6 +4,7 @@
 #include "Defines.hpp"
 
 // STL includes
+#include <vector>
 
 // Boost includes
 
@@ -15,6 +16,14 @@ namespace Grid {
 
    // component-scope variables
    extern DelayedConst<unsigned int> Ng;     // the number of guard cells around the borders
+   extern DelayedConst<unsigned int> Ng_step;   // the guard cells used by one step
+   extern DelayedConst<unsigned int> halo_depth; // steps between guard cell fills
+   extern unsigned int halo_age;    // steps since the guard cells were filled
+
+   // Tiles for the task scheduler: size, and the first cell of each tile but
+   // the first (0 = no tiles)
+   extern DelayedConst<unsigned int> tile_cells;
+   extern std::vector<int> tile_starts;
 
    extern DelayedConst<unsigned int> Nx_global;
    extern DelayedConst<unsigned int> Nx_local;
@@ -28,6 +37,10 @@ namespace Grid {
    // The processor IDs of the lower and upper neighbors
    extern DelayedConst<int> neigh_lo, neigh_hi;
 
+   // Is the output written by a background thread (Grid.async_output) or a
+   // child process (Grid.fork_output)?
+   extern DelayedConst<bool> async_output, fork_output;
+
    // =========================================================================
    // Add a new variable to the Grid
 
@@ -46,13 +59,43 @@ namespace Grid {
    // =========================================================================
    // Fill boundary conditions
 
+   void begin_boundary_exchange();
+
+   void finish_boundary_exchange();
+   bool test_boundary_exchange();
+
    void fill_boundary_conditions();
 
+   // =========================================================================
+   // Deep halos: are the guard cells used up, and count a step taken on them
+   bool exchange_due();
+   void end_step();
+
+   // =========================================================================
+   // Change the local grid to internal cells cell_lo to cell_hi-1 (the data
+   // must be refilled)
+
+   void set_local_cells (int cell_lo, int cell_hi);
+
+   // =========================================================================
+   // Load balancing: report the time this processor spent on a step, and
+   // redistribute the cells if the processors are out of balance
+
+   void balance_load (double step_time);
+
    // =========================================================================
    // Write the data to a file
 
    std::string write_data ();
 
+   // =========================================================================
+   // Write a visualization snapshot (viz_NNNNNN.snap): the variables are
+   // kept only to within the error bounds (Grid.viz_abs_error and
+   // Grid.viz_rel_error), which lets them compress far better; such a file
+   // cannot be used to restart
+
+   std::string write_visualization ();
+
    // =========================================================================
    // Load data from a file
 
@@ -4,11 +4,15 @@
 #include "Defines.hpp"
 
 #include <cassert>
+#include <cstddef>
 #include <iostream>
 #include <sstream>
 #include <stdexcept>
+#include <string>
+#include <vector>
 
 #include "Grid.hpp"
+#include "Support.hpp"
 
 namespace Grid {
 
@@ -16,6 +20,145 @@ namespace Grid {
    extern DelayedConst<int> ilo, ihi;
    extern DelayedConst<unsigned int> n_vars;
 
+   // =========================================================================
+   // Memory layouts for multi-variable grid data
+   // - AOS   : array of structures; all variables of a cell are adjacent
+   //           --> offset = j*Nv + v
+   // - SOA   : structure of arrays; each variable is one contiguous array
+   //           --> offset = v*N + j
+   // - AOSOA : array of structures of arrays; cells are grouped into tiles of
+   //           width T, and each variable is contiguous within a tile
+   //           --> offset = ((j/T)*Nv + v)*T + j%T
+   // where j = idx - lo is the zero-based cell (or face) index.  The (idx,var)
+   // indexing of CellVar and FaceVar is the same for all layouts.
+   enum Layout { AOS, SOA, AOSOA };
+
+   // Default layout used by init(num_vars) (set from the parameter file)
+   extern DelayedConst<Layout> layout;
+   extern DelayedConst<unsigned int> tile_width;
+
+   // Convert between a layout and its name in the parameter file
+   Layout layout_from_string(std::string name);
+   std::string layout_to_string(Layout lay);
+
+   // =========================================================================
+   // The shape of a block of grid data: index range, number of variables, and
+   // memory layout.  Shared by CellVar and FaceVar.
+   class VarShape {
+
+      public:
+
+         int lo;              // lowest valid index
+         unsigned int n;      // number of cells (or faces)
+         unsigned int Nv;     // number of variables
+         Layout lay;          // memory layout
+         unsigned int T;      // tile width (AOSOA only)
+
+         VarShape () : lo(0), n(0), Nv(0), lay(AOS), T(1) {
+         }
+
+         VarShape (int lo_in, unsigned int n_in, unsigned int Nv_in,
+               Layout lay_in, unsigned int T_in) :
+            lo(lo_in), n(n_in), Nv(Nv_in), lay(lay_in), T(T_in) {
+            if (lay == AOSOA && T == 0) {
+               throw std::invalid_argument("AOSOA tile width must be positive");
+            }
+         }
+
+         // Number of doubles to allocate (AOSOA pads the last tile)
+         std::size_t storage_size () const {
+            if (lay == AOSOA) {
+               return std::size_t((n + T - 1) / T) * T * Nv;
+            } else {
+               return std::size_t(n) * Nv;
+            }
+         }
+
+         // Location of (idx,var) in the storage
+         std::size_t offset (int idx, unsigned int var) const {
+            std::size_t j = idx - lo;
+            switch (lay) {
+               case SOA:
+                  return std::size_t(var) * n + j;
+               case AOSOA:
+                  return ((j / T) * Nv + var) * T + j % T;
+               default:
+                  return j * Nv + var;
+            }
+         }
+
+         bool operator== (const VarShape &other) const {
+            return (lo == other.lo) && (n == other.n) && (Nv == other.Nv) &&
+               (lay == other.lay) && ((lay != AOSOA) || (T == other.T));
+         }
+
+         bool operator!= (const VarShape &other) const {
+            return !(*this == other);
+         }
+
+   };
+
+   // =========================================================================
+   // Unchecked view of one variable of a CellVar or FaceVar, for hot loops.
+   // - Capture a view once (e.g. once per step) and index it with [idx]; this
+   //   avoids the range checks, exceptions, and DelayedConst reads done by
+   //   CellVar::operator().
+   // - AOS and SOA data are plain strided arrays (ptr[(idx-lo)*stride]); AOSOA
+   //   data is contiguous within each tile of width T.
+   // - Bounds are only checked with assert, so release builds (-DNDEBUG) have
+   //   no checks at all.
+   // - A view does not own its data and is invalidated if the variable it
+   //   came from is re-initialized or destroyed.
+   class VarView {
+
+      public:
+
+         double *ptr;               // address of element lo
+         int lo;                    // lowest valid index
+         unsigned int n;            // number of valid indices
+         std::size_t stride;        // distance between consecutive indices
+         unsigned int T;            // tile width (0 if untiled)
+         std::size_t tile_stride;   // distance between consecutive tiles
+
+         VarView () :
+            ptr(NULL), lo(0), n(0), stride(1), T(0), tile_stride(0) {
+         }
+
+         VarView (double *data, const VarShape &shape, unsigned int var) :
+            ptr(data + shape.offset(shape.lo, var)), lo(shape.lo), n(shape.n),
+            stride(1), T(0), tile_stride(0) {
+            assert(var < shape.Nv);
+            switch (shape.lay) {
+               case SOA:
+                  stride = 1;
+                  break;
+               case AOSOA:
+                  T = shape.T;
+                  tile_stride = std::size_t(shape.T) * shape.Nv;
+                  break;
+               default:
+                  stride = shape.Nv;
+                  break;
+            }
+         }
+
+         // True if the view is a strided array (no tiling)
+         bool is_strided () const {
+            return T == 0;
+         }
+
+         double& operator[] (int idx) const {
+            assert((lo <= idx) && (idx < lo + int(n)));
+            std::size_t j = idx - lo;
+            if (T == 0) {
+               return ptr[j*stride];
+            } else {
+               return ptr[(j/T)*tile_stride + j%T];
+            }
+         }
+
+   };
+
    // =========================================================================
    // Cell-centered variables
    class CellVar {
@@ -24,7 +167,19 @@ namespace Grid {
 
          double *data;
          bool uninitialized;
-         unsigned int Nv;
+         VarShape shape;
+
+         void allocate (const VarShape &new_shape) {
+            if (uninitialized) {
+               shape = new_shape;
+               data = new double [shape.storage_size()];
+               uninitialized = false;
+            } else if (new_shape != shape) {
+               delete [] data;
+               shape = new_shape;
+               data = new double [shape.storage_size()];
+            }
+         }
 
       public:
 
@@ -35,33 +190,21 @@ namespace Grid {
 
          void init () {
             if (Nx_local.is_set()) {
-               if (uninitialized) {
-                  Nv = 1;
-                  data = new double [Nx_local+2*Ng];
-                  uninitialized = false;
-               } else {
-                  if (Nv != 1) {
-                     delete [] data;
-                     Nv = 1;
-                     data = new double [Nx_local+2*Ng];
-                  }
-               }
+               allocate(VarShape(ilo, Nx_local+2*Ng, 1, AOS, 1));
             }
          }
 
          void init (unsigned int num_vars) {
+            if (layout.is_set()) {
+               init(num_vars, layout, tile_width);
+            } else {
+               init(num_vars, AOS, 1);
+            }
+         }
+
+         void init (unsigned int num_vars, Layout lay, unsigned int T = 1) {
             if (Nx_local.is_set()) {
-               if (uninitialized) {
-                  Nv = num_vars;
-                  data = new double [(Nx_local+2*Ng)*Nv];
-                  uninitialized = false;
-               } else {
-                  if (num_vars != Nv) {
-                     delete [] data;
-                     Nv = num_vars;
-                     data = new double [(Nx_local+2*Ng)*Nv];
-                  }
-               }
+               allocate(VarShape(ilo, Nx_local+2*Ng, num_vars, lay, T));
             }
          }
 
@@ -69,46 +212,71 @@ namespace Grid {
             if (!uninitialized) {
                delete [] data;
                data = NULL;
-               Nv = 0;
+               shape = VarShape();
                uninitialized = true;
             }
          }
 
          double& operator() (int idx) {
             assert(!uninitialized);
-            assert(Nv == 1);
-            if ((idx < ilo) || (ihi <= idx)) {
+            assert(shape.Nv == 1);
+            if ((idx < shape.lo) || (shape.lo + int(shape.n) <= idx)) {
                std::stringstream ss;
                ss << "out of range index in CellVar";
                throw std::out_of_range(ss.str());
             } else {
-               return data[idx-ilo];
+               return data[idx-shape.lo];
             }
          }
 
          double& operator() (int idx, unsigned int var) {
             assert(!uninitialized);
-            if ((idx < ilo) || (ihi <= idx)) {
+            if ((idx < shape.lo) || (shape.lo + int(shape.n) <= idx)) {
                std::stringstream ss;
                ss << "out of range index in CellVar";
                throw std::out_of_range(ss.str());
-            } else if (var >= Nv) {
+            } else if (var >= shape.Nv) {
                std::stringstream ss;
                ss << "out of range variable in CellVar";
                throw std::out_of_range(ss.str());
             } else {
-               return data[(idx-ilo)*Nv + var];
+               return data[shape.offset(idx, var)];
             }
          }
 
          unsigned int const var_count () {
-            return Nv;
+            return shape.Nv;
+         }
+
+         Layout get_layout () const {
+            return shape.lay;
+         }
+
+         VarView view (unsigned int var = 0) {
+            assert(!uninitialized);
+            return VarView(data, shape, var);
+         }
+
+         // Raw storage and the location of (idx,var) in it, for code that
+         // hands the memory to another library (e.g. MPI datatypes)
+         double* storage () {
+            assert(!uninitialized);
+            return data;
+         }
+
+         std::size_t offset (int idx, unsigned int var) const {
+            assert(!uninitialized);
+            return shape.offset(idx, var);
          }
 
          bool const is_initialized () {
             return !uninitialized;
          }
 
+         std::size_t storage_bytes () const {
+            return uninitialized ? 0 : shape.storage_size() * sizeof(double);
+         }
+
    };
 
    // =========================================================================
@@ -119,7 +287,19 @@ namespace Grid {
 
          double *data;
          bool uninitialized;
-         unsigned int Nv;
+         VarShape shape;
+
+         void allocate (const VarShape &new_shape) {
+            if (uninitialized) {
+               shape = new_shape;
+               data = new double [shape.storage_size()];
+               uninitialized = false;
+            } else if (new_shape != shape) {
+               delete [] data;
+               shape = new_shape;
+               data = new double [shape.storage_size()];
+            }
+         }
 
       public:
 
@@ -130,33 +310,21 @@ namespace Grid {
 
          void init () {
             if (Nx_local.is_set()) {
-               if (uninitialized) {
-                  Nv = 1;
-                  data = new double [Nx_local+2*Ng-1];
-                  uninitialized = false;
-               } else {
-                  if (Nv != 1) {
-                     delete [] data;
-                     Nv = 1;
-                     data = new double [Nx_local+2*Ng-1];
-                  }
-               }
+               allocate(VarShape(ilo, Nx_local+2*Ng-1, 1, AOS, 1));
             }
          }
 
          void init (unsigned int num_vars) {
+            if (layout.is_set()) {
+               init(num_vars, layout, tile_width);
+            } else {
+               init(num_vars, AOS, 1);
+            }
+         }
+
+         void init (unsigned int num_vars, Layout lay, unsigned int T = 1) {
             if (Nx_local.is_set()) {
-               if (uninitialized) {
-                  Nv = num_vars;
-                  data = new double [(Nx_local+2*Ng-1)*Nv];
-                  uninitialized = false;
-               } else {
-                  if (num_vars != Nv) {
-                     delete [] data;
-                     Nv = num_vars;
-                     data = new double [(Nx_local+2*Ng-1)*Nv];
-                  }
-               }
+               allocate(VarShape(ilo, Nx_local+2*Ng-1, num_vars, lay, T));
             }
          }
 
@@ -164,48 +332,191 @@ namespace Grid {
             if (!uninitialized) {
                delete [] data;
                data = NULL;
-               Nv = 0;
+               shape = VarShape();
                uninitialized = true;
             }
          }
 
          double& operator() (int idx) {
             assert(!uninitialized);
-            assert(Nv == 1);
-            if ((idx < ilo) || (ihi-1 <= idx)) {
+            assert(shape.Nv == 1);
+            if ((idx < shape.lo) || (shape.lo + int(shape.n) <= idx)) {
                std::stringstream ss;
-               ss << "out of range index in CellVar";
+               ss << "out of range index in FaceVar";
                throw std::out_of_range(ss.str());
             } else {
-               return data[idx-ilo];
+               return data[idx-shape.lo];
             }
          }
 
          double& operator() (int idx, unsigned int var) {
             assert(!uninitialized);
-            if ((idx < ilo) || (ihi-1 <= idx)) {
+            if ((idx < shape.lo) || (shape.lo + int(shape.n) <= idx)) {
                std::stringstream ss;
                ss << "out of range index in FaceVar";
                throw std::out_of_range(ss.str());
-            } else if (Nv <= var) {
+            } else if (shape.Nv <= var) {
                std::stringstream ss;
                ss << "out of range variable in FaceVar";
                throw std::out_of_range(ss.str());
             } else {
-               return data[(idx-ilo)*Nv + var];
+               return data[shape.offset(idx, var)];
             }
          }
 
          unsigned int const var_count () {
-            return Nv;
+            return shape.Nv;
+         }
+
+         Layout get_layout () const {
+            return shape.lay;
+         }
+
+         VarView view (unsigned int var = 0) {
+            assert(!uninitialized);
+            return VarView(data, shape, var);
          }
 
          bool const is_initialized () {
             return !uninitialized;
          }
 
+         std::size_t storage_bytes () const {
+            return uninitialized ? 0 : shape.storage_size() * sizeof(double);
+         }
+
    };
 
+   // =========================================================================
+   // Pool of reusable workspaces (CellVar or FaceVar) for per-step temporaries
+   // - Components borrow from the pools with a Scratch handle instead of
+   //   declaring local grid variables, so grid-sized buffers are allocated
+   //   only the first time they are needed, never freed during the run.
+   // - The Grid may reserve workspaces during setup; if more are borrowed at
+   //   once than the pool holds, it grows.  The high-water mark records the
+   //   most ever in use.
+   template <class Var>
+   class ScratchPool {
+
+      private:
+
+         std::vector<Var*> all;     // every workspace owned by the pool
+         std::vector<Var*> avail;   // workspaces not currently borrowed
+         unsigned int Nv;           // number of variables per workspace
+         unsigned int in_use;       // number currently borrowed
+         unsigned int high_water;   // maximum number ever borrowed at once
+
+         Var* create () {
+            Var *var = new Var;
+            var->init(Nv);
+            all.push_back(var);
+            return var;
+         }
+
+         // Not copyable (owns its workspaces)
+         ScratchPool (const ScratchPool&);
+         ScratchPool& operator= (const ScratchPool&);
+
+      public:
+
+         ScratchPool () : Nv(0), in_use(0), high_water(0) {
+         }
+
+         ~ScratchPool () {
+            clear();
+         }
+
+         // Allocate n workspaces of num_vars variables each
+         void reserve (unsigned int n, unsigned int num_vars) {
+            assert(in_use == 0);
+            clear();
+            Nv = num_vars;
+            for (unsigned int i = 0; i < n; i++) {
+               avail.push_back(create());
+            }
+         }
+
+         // Free all workspaces
+         void clear () {
+            assert(in_use == 0);
+            for (unsigned int i = 0; i < all.size(); i++) {
+               delete all[i];
+            }
+            all.clear();
+            avail.clear();
+         }
+
+         Var* acquire () {
+            Var *var;
+            if (avail.empty()) {
+               var = create();
+            } else {
+               var = avail.back();
+               avail.pop_back();
+            }
+            in_use++;
+            if (in_use > high_water) {
+               high_water = in_use;
+            }
+            return var;
+         }
+
+         void release (Var *var) {
+            assert(in_use > 0);
+            in_use--;
+            avail.push_back(var);
+         }
+
+         unsigned int size () const {
+            return all.size();
+         }
+
+         unsigned int peak () const {
+            return high_water;
+         }
+
+         std::size_t peak_bytes () const {
+            return all.empty() ? 0 : high_water * all[0]->storage_bytes();
+         }
+
+   };
+
+   // Borrow a workspace from a pool for the lifetime of the handle
+   template <class Var>
+   class Scratch {
+
+      private:
+
+         ScratchPool<Var> &pool;
+         Var *var;
+
+         // Not copyable (would return the workspace twice)
+         Scratch (const Scratch&);
+         Scratch& operator= (const Scratch&);
+
+      public:
+
+         Scratch (ScratchPool<Var> &p) : pool(p), var(p.acquire()) {
+         }
+
+         ~Scratch () {
+            pool.release(var);
+         }
+
+         Var& operator* () {
+            return *var;
+         }
+
+         Var* operator-> () {
+            return var;
+         }
+
+   };
+
+   // The Grid's pools (reserved in Grid::setup)
+   extern ScratchPool<CellVar> cell_scratch;
+   extern ScratchPool<FaceVar> face_scratch;
+
 }
 
 #endif // ifndef GRIDVARS_HPP
@@ -1,7 +1,13 @@
 #include "Defines.hpp"
 
 // STL includes
-#include<cmath>
+#include <cmath>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
 
 // Boost includes
 
@@ -10,8 +16,10 @@
 #include "Grid.hpp"
 #include "GridVars.hpp"
 #include "Hydro.hpp"
+#include "HydroKernels.hpp"
 #include "Log.hpp"
 #include "Parameters.hpp"
+#include "Threads.hpp"
 
 namespace Hydro {
 
@@ -19,6 +27,38 @@ namespace Hydro {
    double v_adv;     // The advection speed
    double f_cfl;     // The maximum allowed fraction of CFL time step
 
+   // Use the fused single-pass kernel or the three-stage path
+   DelayedConst<bool> fused;
+
+   // The specialization of the fused kernel (chosen during setup), and the
+   // views and flux buffers it works on
+   StepKernel fused_kernel;
+   std::vector<Grid::VarView> views;
+   std::vector<double> work;
+
+   // Hand-vectorized loops used by the fused kernel for unit-stride data
+   const Simd::Isa *simd;
+
+   // Tiled steps: the kernels, and the task graph of each step (see
+   // tiled_step) with its tile limits, the fluxes through the faces between
+   // tiles, and the exchange event (if any)
+   DelayedConst<bool> tiled;
+   TileKernels tile_kernel;
+   struct TileGraph {
+      Threads::TaskGraph graph;
+      std::vector<int> cuts;
+      std::vector<double> work;
+      unsigned int halo;
+   };
+
+   // The graphs depend only on the local cells, the steps since the last
+   // exchange, and whether an exchange is in flight, so each is built once
+   // for those and kept until the local cells change; dt/dx is read by the
+   // tasks when they run
+   std::map<std::pair<unsigned int, bool>, TileGraph> tile_graphs;
+   int tile_ilo = 0, tile_ihi = 0;
+   double tile_dt_dx;
+
    // Variable indices
    //DelayedConst<unsigned int> idx_fld1, idx_fld2;
 
@@ -36,6 +76,10 @@ namespace Hydro {
       // ----------------------------------------------------------------------
       // Declare variables
 
+      std::string kernel;
+      bool specialized;
+      std::stringstream ss;
+
       // ----------------------------------------------------------------------
       // Initialize the Hydro component
 
@@ -48,12 +92,62 @@ namespace Hydro {
       // Maximum allowed fraction of a CFL time step
       f_cfl = Parameters::get_optional<double>("Hydro.f_cfl", 0.75);
 
+      // Which implementation of the step to use
+      // - fused  : one sweep per variable, no intermediate face arrays
+      // - staged : separate reconstruction, Riemann, and update passes (kept
+      //            for verification; gives bit-identical results)
+      kernel = Parameters::get_optional<std::string>("Hydro.kernel", "fused");
+      if (kernel == "fused") {
+         fused = true;
+      } else if (kernel == "staged") {
+         fused = false;
+      } else {
+         throw std::invalid_argument("unknown Hydro.kernel \"" + kernel +
+               "\" (expected fused or staged)");
+      }
+
+      // Pick the fused kernel specialization
+      // --> The variable count and the number of guard cells used by a step
+      //     are fixed by the Grid setup, so this is done once.
+      fused_kernel = select_step_kernel(Grid::n_vars, Grid::Ng_step, v_adv,
+            specialized);
+      views.resize(Grid::n_vars);
+      tiled = fused && (Grid::tile_cells > 0);
+      tile_kernel = select_tile_kernels(Grid::n_vars, v_adv);
+      work.resize((4 + 2*Threads::n_threads + 1)*Grid::n_vars);
+
+      // Pick the instruction set for the vectorized loops
+      // --> "auto" uses the most advanced one this processor supports; they
+      //     all give identical results.
+      simd = &Simd::from_string(
+            Parameters::get_optional<std::string>("Hydro.simd", "auto"));
+      ss << "Hydro kernel: " << kernel;
+      if (fused) {
+         ss << " (" << (specialized ? "specialized" : "generic");
+         ss << " for " << Grid::n_vars << " variables, " << Grid::Ng_step;
+         ss << " guard cells per step, upwind sign ";
+         ss << ((v_adv > 0) ? "+1" : ((v_adv < 0) ? "-1" : "0")) << ")";
+         ss << std::endl << "Vector instructions: " << simd->name;
+         if (Grid::data.get_layout() != Grid::SOA) {
+            ss << " (only used with the soa layout)";
+         }
+         if (tiled) {
+            ss << std::endl << "Running as tasks on tiles of ";
+            ss << Grid::tile_cells << " cells";
+         }
+      } else if (Grid::tile_cells > 0) {
+         ss << std::endl << "(Grid.tile_cells is ignored by this kernel)";
+      }
+      ss << std::endl << std::endl;
+      Log::write_single(ss.str());
+
    }
 
    // =========================================================================
    // Clean up
 
    void cleanup () {
+      tile_graphs.clear();
    }
 
    // =========================================================================
@@ -71,22 +165,47 @@ namespace Hydro {
 
    void one_step () {
 
+      if (tiled) {
+         tiled_step(false);
+         return;
+      } else if (fused) {
+         fused_step(ALL_CELLS);
+         return;
+      }
+
       // ----------------------------------------------------------------------
       // Declare variables
 
-      Grid::FaceVar fluxes;
+      Grid::Scratch<Grid::FaceVar> fluxes(Grid::face_scratch);
 
       // ----------------------------------------------------------------------
       // Hydro step
 
       // Compute the fluxes
-      compute_fluxes(fluxes);
+      compute_fluxes(*fluxes);
 
       // Update the variables
-      update(fluxes);
+      update(*fluxes);
 
    }
 
+   // =========================================================================
+   // A single hydrodynamics step, in two parts
+
+   void interior_step () {
+      if (fused) {
+         fused_step(INTERIOR_CELLS);
+      }
+   }
+
+   void edge_step () {
+      if (fused) {
+         fused_step(EDGE_CELLS);
+      } else {
+         one_step();
+      }
+   }
+
    // =========================================================================
    // Compute the fluxes
 
@@ -95,16 +214,17 @@ namespace Hydro {
       // ----------------------------------------------------------------------
       // Declare variables
 
-      Grid::FaceVar upper, lower;
+      Grid::Scratch<Grid::FaceVar> upper(Grid::face_scratch);
+      Grid::Scratch<Grid::FaceVar> lower(Grid::face_scratch);
 
       // ----------------------------------------------------------------------
       // Compute the fluxes
 
       // Reconstruction
-      reconstruction(lower, upper);
+      reconstruction(*lower, *upper);
 
       // Riemann solve
-      riemann(lower, upper, fluxes);
+      riemann(*lower, *upper, fluxes);
 
    }
 
@@ -114,15 +234,25 @@ namespace Hydro {
 
    void reconstruction(Grid::FaceVar &lower, Grid::FaceVar &upper) {
 
+      // ----------------------------------------------------------------------
+      // Declare variables
+
+      const int lo = Grid::ilo;
+      const int hi = Grid::ihi - 1;
+      const unsigned int nv = Grid::n_vars;
+
       // ----------------------------------------------------------------------
       // Reconstruct
 
-      lower.init(Grid::n_vars);
-      upper.init(Grid::n_vars);
-      for (int i = Grid::ilo; i < Grid::ihi-1; i++) {
-         for (unsigned int v = 0; v < Grid::n_vars; v++) {
-            lower(i,v) = Grid::data(i,  v);
-            upper(i,v) = Grid::data(i+1,v);
+      lower.init(nv);
+      upper.init(nv);
+      for (unsigned int v = 0; v < nv; v++) {
+         const Grid::VarView q = Grid::data.view(v);
+         const Grid::VarView ql = lower.view(v);
+         const Grid::VarView qu = upper.view(v);
+         for (int i = lo; i < hi; i++) {
+            ql[i] = q[i];
+            qu[i] = q[i+1];
          }
       }
 
@@ -134,27 +264,33 @@ namespace Hydro {
    void riemann (Grid::FaceVar &lower, Grid::FaceVar &upper,
          Grid::FaceVar &fluxes) {
 
+      // ----------------------------------------------------------------------
+      // Declare variables
+
+      const int lo = Grid::ilo;
+      const int hi = Grid::ihi - 1;
+      const unsigned int nv = Grid::n_vars;
+
       // ----------------------------------------------------------------------
       // Solve the Riemann problem
 
-      fluxes.init(Grid::n_vars);
+      fluxes.init(nv);
 
-      if (v_adv == 0) {
-         for (int i = Grid::ilo; i < Grid::ihi-1; i++) {
-            for (unsigned int v = 0; v < Grid::n_vars; v++) {
-               fluxes(i,v) = 0;
+      for (unsigned int v = 0; v < nv; v++) {
+         const Grid::VarView f = fluxes.view(v);
+         if (v_adv == 0) {
+            for (int i = lo; i < hi; i++) {
+               f[i] = 0;
             }
-         }
-      } else if (v_adv > 0) {
-         for (int i = Grid::ilo; i < Grid::ihi-1; i++) {
-            for (unsigned int v = 0; v < Grid::n_vars; v++) {
-               fluxes(i,v) = v_adv * lower(i,v);
+         } else if (v_adv > 0) {
+            const Grid::VarView ql = lower.view(v);
+            for (int i = lo; i < hi; i++) {
+               f[i] = v_adv * ql[i];
             }
-         }
-      } else /*(v_adv < 0)*/ {
-         for (int i = Grid::ilo; i < Grid::ihi-1; i++) {
-            for (unsigned int v = 0; v < Grid::n_vars; v++) {
-               fluxes(i,v) = v_adv * upper(i,v);
+         } else /*(v_adv < 0)*/ {
+            const Grid::VarView qu = upper.view(v);
+            for (int i = lo; i < hi; i++) {
+               f[i] = v_adv * qu[i];
             }
          }
       }
@@ -169,6 +305,9 @@ namespace Hydro {
       // ----------------------------------------------------------------------
       // Declare variables
 
+      const int lo = Grid::ilo;
+      const int hi = Grid::ihi - 1;
+      const unsigned int nv = Grid::n_vars;
       double dt_dx;
       double dQ;
 
@@ -176,16 +315,181 @@ namespace Hydro {
       // Update
 
       dt_dx = Driver::dt / Grid::dx;
-      for (int i = Grid::ilo; i < Grid::ihi-1; i++) {
-         for (unsigned int v = 0; v < Grid::n_vars; v++) {
-            dQ = fluxes(i,v) * dt_dx;
+      for (unsigned int v = 0; v < nv; v++) {
+         const Grid::VarView q = Grid::data.view(v);
+         const Grid::VarView f = fluxes.view(v);
+         for (int i = lo; i < hi; i++) {
+            dQ = f[i] * dt_dx;
             // Matter flowing out to the right
-            Grid::data(i,v) -= dQ;
+            q[i] -= dQ;
             // Matter flowing in from the left
-            Grid::data(i+1,v) += dQ;
+            q[i+1] += dQ;
+         }
+      }
+
+   }
+
+   // =========================================================================
+   // Fused single-pass step
+   //    Computes the interface states, the fluxes, and the flux differences
+   // for each cell in one sweep over the data, so the face arrays used by the
+   // three-stage path are never built.  The arithmetic is the same as in the
+   // three-stage path (each cell becomes (q + dQ_left) - dQ_right, with
+   // dQ = flux * dt/dx), so the results are bit-for-bit identical.  The
+   // kernel is specialized for the variable count, guard cell count, and
+   // upwind direction (see HydroKernels.hpp) and is chosen during setup.
+   //    With deep halos, the cells that are still valid shrink by Ng_step at
+   // each end with every step since the last guard cell exchange.  (The
+   // three-stage path updates every cell and lets the invalid values at the
+   // ends grow by one cell per step, which never reaches the internal cells
+   // before the next exchange.)  The cells that must wait for an exchange
+   // are the guard cells and the internal cells sent to the neighbors, so the
+   // edges are 2*Ng-Ng_step updated cells wide.
+
+   void fused_step (StepPhase phase) {
+
+      // ----------------------------------------------------------------------
+      // Declare variables
+
+      const unsigned int nv = Grid::n_vars;
+      const int shrink = Grid::halo_age * Grid::Ng_step;
+      const int n_edge = 2*Grid::Ng - Grid::Ng_step;
+      double dt_dx;
+
+      // ----------------------------------------------------------------------
+      // Update
+
+      for (unsigned int v = 0; v < nv; v++) {
+         views[v] = Grid::data.view(v);
+      }
+      dt_dx = Driver::dt / Grid::dx;
+      fused_kernel(&views[0], nv, Grid::Ng_step, n_edge,
+            Grid::ilo + shrink, Grid::ihi - shrink,
+            &work[0], v_adv, dt_dx, simd, phase);
+
+   }
+
+   // =========================================================================
+   // Fused step as tasks on tiles
+   //    The cells updated by the fused step are cut at the Grid's tile
+   // starts.  Each tile is one task, which sweeps the tile with the fused
+   // kernel; the flux differences through the face below each tile are a
+   // task of their own, computed from the old values, that the tiles on both
+   // sides wait for (as in the interior/edge split, so the results are the
+   // same).  With an exchange in flight, the faces that read guard cells and
+   // the tiles that write guard cells or the cells being sent also wait for
+   // the exchange, which thread 0 checks for between tasks; all other tiles
+   // start immediately, and idle threads steal them from busy ones.
+
+   // Build the task graph of a tiled step
+   void build_tile_graph (TileGraph &tg, bool halo_pending) {
+
+      // ----------------------------------------------------------------------
+      // Declare variables
+
+      const unsigned int nv = Grid::n_vars;
+      const int g = Grid::Ng_step;
+      const int shrink = Grid::halo_age * g;
+      const int lo = Grid::ilo + shrink + g;    // updated cells
+      const int hi = Grid::ihi - shrink - g;
+      const int n_edge = 2*Grid::Ng - g;
+      const int a = lo + n_edge;                // cells free of the exchange
+      const int b = hi - n_edge;
+      const int guard_lo = Grid::ilo + Grid::Ng;   // internal cells
+      const int guard_hi = Grid::ihi - Grid::Ng;
+      std::vector<unsigned int> face_id;
+      unsigned int id, n_tiles;
+
+      // ----------------------------------------------------------------------
+      // Cut the cells into tiles
+
+      tg.cuts.clear();
+      tg.cuts.push_back(lo);
+      for (unsigned int k = 0; k < Grid::tile_starts.size(); k++) {
+         if ((lo < Grid::tile_starts[k]) && (Grid::tile_starts[k] < hi)) {
+            tg.cuts.push_back(Grid::tile_starts[k]);
+         }
+      }
+      tg.cuts.push_back(hi);
+      n_tiles = tg.cuts.size() - 1;
+      tg.work.assign((2*n_tiles + 1) * nv, 0.0);
+
+      tg.graph.clear();
+      if (halo_pending) {
+         tg.halo = tg.graph.add_event();
+      }
+
+      // ----------------------------------------------------------------------
+      // Faces: face t lies between cells cuts[t]-1 and cuts[t]
+
+      for (unsigned int t = 0; t <= n_tiles; t++) {
+         const int i = tg.cuts[t] - 1;
+         double *dQ = &tg.work[t*nv];
+         id = tg.graph.add([=] () {
+            tile_kernel.face(&views[0], nv, i, dQ, v_adv, tile_dt_dx);
+         });
+         if (halo_pending && ((i < guard_lo) || (i + 1 >= guard_hi))) {
+            tg.graph.depend(tg.halo, id);
+         }
+         face_id.push_back(id);
+      }
+
+      // ----------------------------------------------------------------------
+      // Tiles
+
+      for (unsigned int t = 0; t < n_tiles; t++) {
+         const int c0 = tg.cuts[t];
+         const int c1 = tg.cuts[t+1];
+         const double *dQ_lo = &tg.work[t*nv];
+         const double *dQ_hi = &tg.work[(t+1)*nv];
+         double *carry = &tg.work[(n_tiles + 1 + t)*nv];
+         id = tg.graph.add([=] () {
+            for (unsigned int iv = 0; iv < nv; iv++) {
+               carry[iv] = dQ_lo[iv];
+            }
+            tile_kernel.sweep(&views[0], nv, c0, c1, carry, dQ_hi,
+                  v_adv, tile_dt_dx, simd);
+         });
+         tg.graph.depend(face_id[t], id);
+         tg.graph.depend(face_id[t+1], id);
+         if (halo_pending && ((c0 < a) || (c1 > b))) {
+            tg.graph.depend(tg.halo, id);
          }
       }
 
+   }
+
+   void tiled_step (bool halo_pending) {
+
+      // ----------------------------------------------------------------------
+      // Find the task graph (built on the first step like this one)
+
+      if ((tile_ilo != Grid::ilo) || (tile_ihi != Grid::ihi)) {
+         tile_graphs.clear();
+         tile_ilo = Grid::ilo;
+         tile_ihi = Grid::ihi;
+      }
+      TileGraph &tg =
+         tile_graphs[std::make_pair(Grid::halo_age, halo_pending)];
+      if (tg.graph.size() == 0) {
+         build_tile_graph(tg, halo_pending);
+      }
+      bool halo_done = !halo_pending;
+
+      // ----------------------------------------------------------------------
+      // Run it
+
+      for (unsigned int v = 0; v < Grid::n_vars; v++) {
+         views[v] = Grid::data.view(v);
       }
+      tile_dt_dx = Driver::dt / Grid::dx;
 
+      tg.graph.execute([&] () {
+         if (!halo_done && Grid::test_boundary_exchange()) {
+            halo_done = true;
+            tg.graph.complete_event(tg.halo);
+         }
+      });
+
+   }
 }
@@ -9,6 +9,7 @@
 
 // Includes specific to this code
 #include "GridVars.hpp"
+#include "Support.hpp"
 
 namespace Hydro {
 
@@ -16,6 +17,19 @@ namespace Hydro {
    extern double v_adv;     // The advection speed
    const int min_guard = 1;
 
+   // Use the fused single-pass kernel (true) or the three-stage
+   // reconstruction/Riemann/update path (false)
+   extern DelayedConst<bool> fused;
+
+   // Run the fused kernel as tasks on the Grid's tiles (Grid.tile_cells)
+   extern DelayedConst<bool> tiled;
+
+   // Number of cells per block of the fused kernel's rolling window
+   const int fused_block = 64;
+
+   // Which cells a (fused) step updates
+   enum StepPhase { ALL_CELLS, INTERIOR_CELLS, EDGE_CELLS };
+
    // Variable indices
    extern DelayedConst<unsigned int> idx_fld1, idx_fld2;
 
@@ -44,6 +58,17 @@ namespace Hydro {
 
    void one_step ();
 
+   // The same step in two parts, so that the first part can run while the
+   // guard cells are being exchanged (see Grid::begin_boundary_exchange)
+   // - interior_step updates the cells that do not need the guard cells
+   // - edge_step updates the rest, after the guard cells are filled
+   // With the staged kernel, interior_step does nothing and edge_step does
+   // the whole step.
+
+   void interior_step ();
+
+   void edge_step ();
+
    void compute_fluxes (Grid::FaceVar &fluxes);
 
    void reconstruction(Grid::FaceVar &lower, Grid::FaceVar &upper);
@@ -53,6 +78,18 @@ namespace Hydro {
 
    void update (Grid::FaceVar &fluxes);
 
+   // =========================================================================
+   // Fused single-pass step
+
+   void fused_step (StepPhase phase);
+
+   // =========================================================================
+   // Fused step as tasks on tiles
+   // --> With halo_pending, the guard cell exchange has been started; the
+   //     step finishes it (see Grid::test_boundary_exchange)
+
+   void tiled_step (bool halo_pending);
+
 }
 
 #endif
@@ -0,0 +1,341 @@
+#ifndef HYDROKERNELS_HPP
+#define HYDROKERNELS_HPP
+
+#include "Defines.hpp"
+
+// STL includes
+
+// Boost includes
+
+// Includes specific to this code
+#include "GridVars.hpp"
+#include "Hydro.hpp"
+#include "HydroSimd.hpp"
+#include "Threads.hpp"
+
+// ============================================================================
+// Compile-time specialized Hydro kernels
+//    The kernels are templates on the number of variables (NV), the number of
+// guard cells (NG), and the sign of the advection speed (UPWIND).  With fixed
+// values the compiler can unroll the loops over variables and drop the
+// branch on the upwind direction.  A value of zero for NV or NG selects the
+// generic version, which reads the value at run time instead.
+
+namespace Hydro {
+
+   const unsigned int any_vars = 0;    // NV for the generic kernels
+   const int any_guard = 0;            // NG for the generic kernels
+
+   // =========================================================================
+   // Upwind flux through a face, given the states on its lower and upper side
+
+   template <int UPWIND>
+   inline double upwind_flux (double v, double q_lower, double q_upper) {
+      if (UPWIND > 0) {
+         return v * q_lower;
+      } else if (UPWIND < 0) {
+         return v * q_upper;
+      } else {
+         return 0;
+      }
+   }
+
+   // =========================================================================
+   // Update cells lo to hi-1 of all variables in place
+   //    The flux differences through the faces at lo-1/2 and hi-1/2 are given
+   // for each variable (dQ_carry and dQ_hi), so a sweep can cover any
+   // sub-range of the grid.  The sweep works on blocks of fused_block cells;
+   // for each variable, the flux differences for all faces of the block are
+   // computed from the old values (a small rolling window on the stack), then
+   // the block is updated.  Neither loop carries a dependency from one cell
+   // to the next, so both can be vectorized, and all variables of a block
+   // stay in cache between the two loops.  On return, dQ_carry holds dQ_hi.
+   //    If isa is not NULL, variables stored with unit stride use its
+   // hand-vectorized loops (see HydroSimd.hpp) instead.
+
+   template <unsigned int NV, int UPWIND>
+   void sweep_kernel (const Grid::VarView *q, unsigned int n_vars,
+         int lo, int hi, double *dQ_carry, const double *dQ_hi,
+         double v, double dt_dx, const Simd::Isa *isa) {
+
+      const unsigned int nv = (NV == any_vars) ? n_vars : NV;
+      double dQ[fused_block+1];  // dQ[k] : face between cells b+k-1 and b+k
+      int b, e, k;
+
+      for (b = lo; b < hi; b = e) {
+         e = (b + fused_block < hi) ? b + fused_block : hi;
+         for (unsigned int iv = 0; iv < nv; iv++) {
+            const Grid::VarView qv = q[iv];
+            const bool vectorize = (isa != NULL) && (UPWIND != 0) &&
+               qv.is_strided() && (qv.stride == 1);
+            // Flux differences through the upper face of each cell
+            // --> qv[e] has not been updated yet, so it is still the old value
+            dQ[0] = dQ_carry[iv];
+            if (vectorize) {
+               isa->flux(&qv[(UPWIND > 0) ? b : b+1], &dQ[1], e-b-1,
+                     v, dt_dx);
+            } else {
+               for (k = 1; k < e - b; k++) {
+                  dQ[k] = upwind_flux<UPWIND>(v, qv[b+k-1], qv[b+k]) * dt_dx;
+               }
+            }
+            if (e < hi) {
+               dQ[e-b] = upwind_flux<UPWIND>(v, qv[e-1], qv[e]) * dt_dx;
+            } else {
+               dQ[e-b] = dQ_hi[iv];
+            }
+            // Update the cells in the block
+            if (vectorize) {
+               isa->update(&qv[b], dQ, e-b);
+            } else {
+               for (k = 0; k < e - b; k++) {
+                  qv[b+k] = (qv[b+k] + dQ[k]) - dQ[k+1];
+               }
+            }
+            // Carry the last face into the next block
+            dQ_carry[iv] = dQ[e-b];
+         }
+      }
+
+   }
+
+   // =========================================================================
+   // Flux differences through the face between cells i and i+1
+
+   template <unsigned int NV, int UPWIND>
+   void face_kernel (const Grid::VarView *q, unsigned int n_vars, int i,
+         double *dQ, double v, double dt_dx) {
+      const unsigned int nv = (NV == any_vars) ? n_vars : NV;
+      for (unsigned int iv = 0; iv < nv; iv++) {
+         dQ[iv] = upwind_flux<UPWIND>(v, q[iv][i], q[iv][i+1]) * dt_dx;
+      }
+   }
+
+   // =========================================================================
+   // Update cells lo to hi-1 of all variables in place, using the threads
+   //    The range is split into one part per thread (see Threads::split).
+   // The flux differences through the faces between the parts are computed
+   // from the old values before any part is updated, so every part can be
+   // swept independently and the result does not depend on the number of
+   // threads.  The bounds array holds (2*n_threads+1)*n_vars values: the
+   // faces between the parts, and a carry for each part.  On return, dQ_lo
+   // holds dQ_hi, as with sweep_kernel.
+
+   template <unsigned int NV, int UPWIND>
+   void sweep_range (const Grid::VarView *q, unsigned int n_vars,
+         int lo, int hi, double *dQ_lo, const double *dQ_hi,
+         double v, double dt_dx, const Simd::Isa *isa, double *bounds) {
+
+      const unsigned int nv = (NV == any_vars) ? n_vars : NV;
+      const unsigned int n = Threads::threads_for(hi - lo);
+
+      if (n == 1) {
+         sweep_kernel<NV,UPWIND>(q, nv, lo, hi, dQ_lo, dQ_hi, v, dt_dx, isa);
+         return;
+      }
+
+      // Faces between the parts: bounds[t*nv] is the face below part t
+      for (unsigned int iv = 0; iv < nv; iv++) {
+         bounds[iv] = dQ_lo[iv];
+         bounds[n*nv+iv] = dQ_hi[iv];
+      }
+      for (unsigned int t = 1; t < n; t++) {
+         face_kernel<NV,UPWIND>(q, nv, Threads::split(lo, hi, t, n) - 1,
+               bounds + t*nv, v, dt_dx);
+      }
+
+      // Sweep the parts
+      Threads::run(n, [&] (unsigned int t) {
+         double *carry = bounds + (n+1+t)*nv;
+         for (unsigned int iv = 0; iv < nv; iv++) {
+            carry[iv] = bounds[t*nv+iv];
+         }
+         sweep_kernel<NV,UPWIND>(q, nv, Threads::split(lo, hi, t, n),
+               Threads::split(lo, hi, t+1, n), carry, bounds + (t+1)*nv,
+               v, dt_dx, isa);
+      });
+
+      for (unsigned int iv = 0; iv < nv; iv++) {
+         dQ_lo[iv] = dQ_hi[iv];
+      }
+   }
+
+   // =========================================================================
+   // Update cells ilo+n_guard to ihi-n_guard-1
+   //    Cells ilo to ihi-1 hold valid values; the n_guard cells at each end
+   // are only read, since the cells beyond them are not valid.  Normally
+   // ilo and ihi are the grid limits, so the internal cells are updated; with
+   // deep halos (see Grid::exchange_due), the caller narrows them by n_guard
+   // at each end for every step since the last exchange.
+   //    The update can be done all at once (ALL_CELLS) or in two parts so it
+   // can overlap the guard cell exchange: first INTERIOR_CELLS, the cells
+   // that neither read the guard cells nor are sent to the neighbors (all
+   // but n_edge updated cells at each end), then EDGE_CELLS, the rest.  The
+   // interior part saves the fluxes through the faces it shares with the
+   // edges (computed from the old values) for the edge part to use, so the
+   // results are identical either way.  The edges are small, so only the
+   // whole range and the interior are split among the threads.
+   //    The work array holds (4 + 2*Threads::n_threads + 1)*nv values: two
+   // scratch sets of flux differences, the saved fluxes of the interior
+   // part, and the bounds used by sweep_range.
+
+   template <unsigned int NV, int NG, int UPWIND>
+   void step_kernel (const Grid::VarView *q, unsigned int n_vars,
+         unsigned int n_guard, int n_edge, int ilo, int ihi, double *work,
+         double v, double dt_dx, const Simd::Isa *isa, StepPhase phase) {
+      const unsigned int nv = (NV == any_vars) ? n_vars : NV;
+      const int ng = (NG == any_guard) ? int(n_guard) : NG;
+      const int lo = ilo + ng;      // updated cells are lo to hi-1
+      const int hi = ihi - ng;
+      const int a = lo + n_edge;    // interior cells are a to b-1
+      const int b = hi - n_edge;
+      double *dQ_lo = work;
+      double *dQ_hi = work + nv;
+      double *dQ_a  = work + 2*nv;
+      double *dQ_b  = work + 3*nv;
+      double *bounds = work + 4*nv;
+
+      if (a >= b) {
+         // No interior cells: do everything in the edge part
+         if (phase == INTERIOR_CELLS) {
+            return;
+         }
+         phase = ALL_CELLS;
+      }
+
+      switch (phase) {
+         case ALL_CELLS:
+            face_kernel<NV,UPWIND>(q, nv, lo-1, dQ_lo, v, dt_dx);
+            face_kernel<NV,UPWIND>(q, nv, hi-1, dQ_hi, v, dt_dx);
+            sweep_range<NV,UPWIND>(q, nv, lo, hi, dQ_lo, dQ_hi,
+                  v, dt_dx, isa, bounds);
+            break;
+         case INTERIOR_CELLS:
+            face_kernel<NV,UPWIND>(q, nv, a-1, dQ_a, v, dt_dx);
+            face_kernel<NV,UPWIND>(q, nv, b-1, dQ_b, v, dt_dx);
+            for (unsigned int iv = 0; iv < nv; iv++) {
+               dQ_lo[iv] = dQ_a[iv];
+            }
+            sweep_range<NV,UPWIND>(q, nv, a, b, dQ_lo, dQ_b,
+                  v, dt_dx, isa, bounds);
+            break;
+         case EDGE_CELLS:
+            face_kernel<NV,UPWIND>(q, nv, lo-1, dQ_lo, v, dt_dx);
+            sweep_kernel<NV,UPWIND>(q, nv, lo, a, dQ_lo, dQ_a,
+                  v, dt_dx, isa);
+            face_kernel<NV,UPWIND>(q, nv, hi-1, dQ_hi, v, dt_dx);
+            for (unsigned int iv = 0; iv < nv; iv++) {
+               dQ_lo[iv] = dQ_b[iv];
+            }
+            sweep_kernel<NV,UPWIND>(q, nv, b, hi, dQ_lo, dQ_hi,
+                  v, dt_dx, isa);
+            break;
+      }
+   }
+
+   // Signature shared by all specializations of step_kernel
+   typedef void (*StepKernel)(const Grid::VarView *q, unsigned int n_vars,
+         unsigned int n_guard, int n_edge, int ilo, int ihi, double *work,
+         double v, double dt_dx, const Simd::Isa *isa, StepPhase phase);
+
+   // =========================================================================
+   // Dispatch table
+   //    Specializations exist for 1-8, 16, and 32 variables and 1-4 guard
+   // cells; anything else falls back to the generic version.
+
+   template <int NG, int UPWIND>
+   StepKernel select_vars (unsigned int n_vars) {
+      switch (n_vars) {
+         case  1: return &step_kernel< 1,NG,UPWIND>;
+         case  2: return &step_kernel< 2,NG,UPWIND>;
+         case  3: return &step_kernel< 3,NG,UPWIND>;
+         case  4: return &step_kernel< 4,NG,UPWIND>;
+         case  5: return &step_kernel< 5,NG,UPWIND>;
+         case  6: return &step_kernel< 6,NG,UPWIND>;
+         case  7: return &step_kernel< 7,NG,UPWIND>;
+         case  8: return &step_kernel< 8,NG,UPWIND>;
+         case 16: return &step_kernel<16,NG,UPWIND>;
+         case 32: return &step_kernel<32,NG,UPWIND>;
+         default: return &step_kernel<any_vars,NG,UPWIND>;
+      }
+   }
+
+   template <int UPWIND>
+   StepKernel select_guard (unsigned int n_guard, unsigned int n_vars) {
+      switch (n_guard) {
+         case 1:  return select_vars<1,UPWIND>(n_vars);
+         case 2:  return select_vars<2,UPWIND>(n_vars);
+         case 3:  return select_vars<3,UPWIND>(n_vars);
+         case 4:  return select_vars<4,UPWIND>(n_vars);
+         default: return select_vars<any_guard,UPWIND>(n_vars);
+      }
+   }
+
+   // Returns the kernel and whether it is specialized (not generic)
+   inline StepKernel select_step_kernel (unsigned int n_vars,
+         unsigned int n_guard, double v, bool &specialized) {
+      specialized = ((1 <= n_vars && n_vars <= 8) || n_vars == 16 ||
+            n_vars == 32) && (1 <= n_guard && n_guard <= 4);
+      if (v > 0) {
+         return select_guard<+1>(n_guard, n_vars);
+      } else if (v < 0) {
+         return select_guard<-1>(n_guard, n_vars);
+      } else {
+         return select_guard<0>(n_guard, n_vars);
+      }
+   }
+
+   // =========================================================================
+   // Kernels for the task scheduler
+   //    A tiled step sweeps each tile with sweep_kernel, with the faces
+   // between tiles computed beforehand by face_kernel (see Hydro::tiled_step);
+   // these pick their specializations.  The number of guard cells does not
+   // matter to either.
+
+   typedef void (*SweepKernel)(const Grid::VarView *q, unsigned int n_vars,
+         int lo, int hi, double *dQ_carry, const double *dQ_hi,
+         double v, double dt_dx, const Simd::Isa *isa);
+   typedef void (*FaceKernel)(const Grid::VarView *q, unsigned int n_vars,
+         int i, double *dQ, double v, double dt_dx);
+
+   struct TileKernels {
+      SweepKernel sweep;
+      FaceKernel face;
+   };
+
+   template <unsigned int NV, int UPWIND>
+   TileKernels tile_kernels () {
+      TileKernels k = { &sweep_kernel<NV,UPWIND>, &face_kernel<NV,UPWIND> };
+      return k;
+   }
+
+   template <int UPWIND>
+   TileKernels select_tile_vars (unsigned int n_vars) {
+      switch (n_vars) {
+         case  1: return tile_kernels< 1,UPWIND>();
+         case  2: return tile_kernels< 2,UPWIND>();
+         case  3: return tile_kernels< 3,UPWIND>();
+         case  4: return tile_kernels< 4,UPWIND>();
+         case  5: return tile_kernels< 5,UPWIND>();
+         case  6: return tile_kernels< 6,UPWIND>();
+         case  7: return tile_kernels< 7,UPWIND>();
+         case  8: return tile_kernels< 8,UPWIND>();
+         case 16: return tile_kernels<16,UPWIND>();
+         case 32: return tile_kernels<32,UPWIND>();
+         default: return tile_kernels<any_vars,UPWIND>();
+      }
+   }
+
+   inline TileKernels select_tile_kernels (unsigned int n_vars, double v) {
+      if (v > 0) {
+         return select_tile_vars<+1>(n_vars);
+      } else if (v < 0) {
+         return select_tile_vars<-1>(n_vars);
+      } else {
+         return select_tile_vars<0>(n_vars);
+      }
+   }
+
+}
+
+#endif // ifndef HYDROKERNELS_HPP
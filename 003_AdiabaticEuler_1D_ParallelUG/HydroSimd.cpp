@@ -0,0 +1,208 @@
+#include "Defines.hpp"
+
+// STL includes
+#include <stdexcept>
+#include <string>
+
+// Other 3rd-party includes
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HYDRO_SIMD_X86
+#include <immintrin.h>
+#endif
+
+// Includes specific to this code
+#include "HydroSimd.hpp"
+
+namespace Hydro {
+
+   namespace Simd {
+
+      // ======================================================================
+      // Plain C++ (reference)
+
+      void flux_scalar (const double *q, double *dQ, int n,
+            double v, double dt_dx) {
+         for (int k = 0; k < n; k++) {
+            dQ[k] = (v * q[k]) * dt_dx;
+         }
+      }
+
+      void update_scalar (double *q, const double *dQ, int n) {
+         for (int k = 0; k < n; k++) {
+            q[k] = (q[k] + dQ[k]) - dQ[k+1];
+         }
+      }
+
+#ifdef HYDRO_SIMD_X86
+
+      // ======================================================================
+      // SSE2 (2 doubles per vector)
+
+      __attribute__((target("sse2")))
+      void flux_sse2 (const double *q, double *dQ, int n,
+            double v, double dt_dx) {
+         const __m128d vv = _mm_set1_pd(v);
+         const __m128d vt = _mm_set1_pd(dt_dx);
+         int k = 0;
+         for (; k + 2 <= n; k += 2) {
+            __m128d x = _mm_loadu_pd(q + k);
+            _mm_storeu_pd(dQ + k, _mm_mul_pd(_mm_mul_pd(vv, x), vt));
+         }
+         for (; k < n; k++) {
+            dQ[k] = (v * q[k]) * dt_dx;
+         }
+      }
+
+      __attribute__((target("sse2")))
+      void update_sse2 (double *q, const double *dQ, int n) {
+         int k = 0;
+         for (; k + 2 <= n; k += 2) {
+            __m128d x = _mm_loadu_pd(q + k);
+            __m128d l = _mm_loadu_pd(dQ + k);
+            __m128d r = _mm_loadu_pd(dQ + k + 1);
+            _mm_storeu_pd(q + k, _mm_sub_pd(_mm_add_pd(x, l), r));
+         }
+         for (; k < n; k++) {
+            q[k] = (q[k] + dQ[k]) - dQ[k+1];
+         }
+      }
+
+      // ======================================================================
+      // AVX2 (4 doubles per vector)
+
+      __attribute__((target("avx2")))
+      void flux_avx2 (const double *q, double *dQ, int n,
+            double v, double dt_dx) {
+         const __m256d vv = _mm256_set1_pd(v);
+         const __m256d vt = _mm256_set1_pd(dt_dx);
+         int k = 0;
+         for (; k + 4 <= n; k += 4) {
+            __m256d x = _mm256_loadu_pd(q + k);
+            _mm256_storeu_pd(dQ + k, _mm256_mul_pd(_mm256_mul_pd(vv, x), vt));
+         }
+         for (; k < n; k++) {
+            dQ[k] = (v * q[k]) * dt_dx;
+         }
+      }
+
+      __attribute__((target("avx2")))
+      void update_avx2 (double *q, const double *dQ, int n) {
+         int k = 0;
+         for (; k + 4 <= n; k += 4) {
+            __m256d x = _mm256_loadu_pd(q + k);
+            __m256d l = _mm256_loadu_pd(dQ + k);
+            __m256d r = _mm256_loadu_pd(dQ + k + 1);
+            _mm256_storeu_pd(q + k, _mm256_sub_pd(_mm256_add_pd(x, l), r));
+         }
+         for (; k < n; k++) {
+            q[k] = (q[k] + dQ[k]) - dQ[k+1];
+         }
+      }
+
+      // ======================================================================
+      // AVX-512 (8 doubles per vector)
+
+      __attribute__((target("avx512f")))
+      void flux_avx512 (const double *q, double *dQ, int n,
+            double v, double dt_dx) {
+         const __m512d vv = _mm512_set1_pd(v);
+         const __m512d vt = _mm512_set1_pd(dt_dx);
+         int k = 0;
+         for (; k + 8 <= n; k += 8) {
+            __m512d x = _mm512_loadu_pd(q + k);
+            _mm512_storeu_pd(dQ + k, _mm512_mul_pd(_mm512_mul_pd(vv, x), vt));
+         }
+         for (; k < n; k++) {
+            dQ[k] = (v * q[k]) * dt_dx;
+         }
+      }
+
+      __attribute__((target("avx512f")))
+      void update_avx512 (double *q, const double *dQ, int n) {
+         int k = 0;
+         for (; k + 8 <= n; k += 8) {
+            __m512d x = _mm512_loadu_pd(q + k);
+            __m512d l = _mm512_loadu_pd(dQ + k);
+            __m512d r = _mm512_loadu_pd(dQ + k + 1);
+            _mm512_storeu_pd(q + k, _mm512_sub_pd(_mm512_add_pd(x, l), r));
+         }
+         for (; k < n; k++) {
+            q[k] = (q[k] + dQ[k]) - dQ[k+1];
+         }
+      }
+
+#endif // ifdef HYDRO_SIMD_X86
+
+      // ======================================================================
+      // Dispatch table
+
+#ifdef HYDRO_SIMD_X86
+      const Isa table[n_isa] = {
+         { "scalar", &flux_scalar, &update_scalar },
+         { "sse2",   &flux_sse2,   &update_sse2   },
+         { "avx2",   &flux_avx2,   &update_avx2   },
+         { "avx512", &flux_avx512, &update_avx512 },
+      };
+#else // HYDRO_SIMD_X86
+      // Not an x86 processor: only the plain C++ routines exist
+      const Isa table[n_isa] = {
+         { "scalar", &flux_scalar, &update_scalar },
+         { "sse2",   &flux_scalar, &update_scalar },
+         { "avx2",   &flux_scalar, &update_scalar },
+         { "avx512", &flux_scalar, &update_scalar },
+      };
+#endif // HYDRO_SIMD_X86
+
+      const Isa& isa (int i) {
+         return table[i];
+      }
+
+      bool supported (int i) {
+#ifdef HYDRO_SIMD_X86
+         __builtin_cpu_init();
+         switch (i) {
+            case 0:
+               return true;
+            case 1:
+               return __builtin_cpu_supports("sse2");
+            case 2:
+               return __builtin_cpu_supports("avx2");
+            case 3:
+               return __builtin_cpu_supports("avx512f");
+            default:
+               return false;
+         }
+#else // HYDRO_SIMD_X86
+         return (i == 0);
+#endif // HYDRO_SIMD_X86
+      }
+
+      const Isa& best () {
+         for (int i = n_isa - 1; i > 0; i--) {
+            if (supported(i)) {
+               return table[i];
+            }
+         }
+         return table[0];
+      }
+
+      const Isa& from_string (std::string name) {
+         if (name == "auto") {
+            return best();
+         }
+         for (int i = 0; i < n_isa; i++) {
+            if (name == table[i].name) {
+               if (!supported(i)) {
+                  throw std::runtime_error("instruction set \"" + name +
+                        "\" is not supported by this processor");
+               }
+               return table[i];
+            }
+         }
+         throw std::invalid_argument("unknown instruction set \"" + name +
+               "\" (expected auto, scalar, sse2, avx2, or avx512)");
+      }
+
+   }
+
+}
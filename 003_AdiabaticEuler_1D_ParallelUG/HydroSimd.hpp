@@ -0,0 +1,60 @@
+#ifndef HYDROSIMD_HPP
+#define HYDROSIMD_HPP
+
+#include "Defines.hpp"
+
+// STL includes
+#include <string>
+
+// Boost includes
+
+// Includes specific to this code
+
+// ============================================================================
+// Hand-vectorized versions of the two inner loops of the fused Hydro kernel
+// for unit-stride data (the SOA layout).  There is one set of routines for
+// each instruction set (plain C++, SSE2, AVX2, and AVX-512); the best one the
+// processor supports is chosen at run time, so one binary runs at full speed
+// on every node.  Each routine finishes the elements that do not fill a whole
+// vector with a scalar loop.  The routines do the same operations in the same
+// order as the scalar code, so all versions give bit-identical results.
+
+namespace Hydro {
+
+   namespace Simd {
+
+      // Upwind flux differences: dQ[k] = (v * q[k]) * dt_dx, k in [0,n)
+      typedef void (*FluxFn)(const double *q, double *dQ, int n,
+            double v, double dt_dx);
+
+      // Cell update: q[k] = (q[k] + dQ[k]) - dQ[k+1], k in [0,n)
+      typedef void (*UpdateFn)(double *q, const double *dQ, int n);
+
+      // One instruction set's routines
+      struct Isa {
+         const char *name;
+         FluxFn flux;
+         UpdateFn update;
+      };
+
+      // Number of instruction sets, from the most basic to the most advanced
+      const int n_isa = 4;
+
+      // The routines for instruction set i (0 is plain C++)
+      const Isa& isa (int i);
+
+      // Does this processor support instruction set i?
+      bool supported (int i);
+
+      // The most advanced supported instruction set
+      const Isa& best ();
+
+      // The instruction set with the given name ("auto" selects the best);
+      // throws if it is unknown or not supported
+      const Isa& from_string (std::string name);
+
+   }
+
+}
+
+#endif // ifndef HYDROSIMD_HPP
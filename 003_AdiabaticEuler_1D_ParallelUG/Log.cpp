@@ -2,6 +2,7 @@
 
 // STL includes
 #include <fstream>
+#include <iostream>
 #include <sstream>
 #include <string>
 
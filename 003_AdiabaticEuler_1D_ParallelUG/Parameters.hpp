@@ -2,6 +2,7 @@
 
 // STL includes
 #include <iomanip>
+#include <iostream>
 #include <string>
 
 // Boost includes
@@ -0,0 +1,614 @@
+#include "Defines.hpp"
+
+// STL includes
+#include <cstring>
+#include <fstream>
+#include <ios>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Boost includes
+
+// Other 3rd-party includes
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Includes specific to this code
+#include "Compress.hpp"
+#include "Snapshot.hpp"
+
+namespace Snapshot {
+
+   const char magic[8] = "TOYSNAP";
+
+   // The table entry of version 1 files (no compression, longer names)
+   struct TableEntryV1 {
+      char name[40];
+      std::uint64_t offset;
+      std::uint64_t count;
+      std::uint64_t reserved;
+   };
+
+   static_assert(sizeof(TableEntryV1) == sizeof(TableEntry),
+         "table entries must have the same size in every version");
+
+   // Round n up to a multiple of the alignment
+   std::size_t aligned (std::size_t n) {
+      return ((n + alignment - 1) / alignment) * alignment;
+   }
+
+   bool is_none (const Compress::Method &method) {
+      return (method.filter == Compress::NO_FILTER) &&
+         (method.codec == Compress::NO_CODEC);
+   }
+
+   int Info::find (const std::string &name) const {
+      for (unsigned int a = 0; a < names.size(); a++) {
+         if (names[a] == name) {
+            return a;
+         }
+      }
+      return -1;
+   }
+
+   bool Info::compressed () const {
+      for (unsigned int a = 0; a < methods.size(); a++) {
+         if (!is_none(methods[a])) {
+            return true;
+         }
+      }
+      return false;
+   }
+
+   // =========================================================================
+   // Header and table
+
+   std::vector<char> encode (Info &info) {
+
+      FileHeader header;
+      TableEntry entry;
+      ChunkEntry chunk_entry;
+      const bool compressed = info.compressed();
+      const std::size_t stride = aligned(info.n_cells * sizeof(double));
+      const std::size_t n_arrays = info.names.size();
+      const std::size_t n_chunks = compressed ? info.chunks[0].size() : 0;
+      const std::size_t chunk_offset =
+         sizeof(FileHeader) + n_arrays * sizeof(TableEntry);
+      const std::size_t data_offset =
+         aligned(chunk_offset + n_arrays * n_chunks * sizeof(ChunkEntry));
+      std::size_t end = data_offset;
+      std::vector<std::size_t> stored(n_arrays);
+      std::vector<char> bytes(data_offset, 0);
+
+      // Where everything goes
+      if (compressed) {
+         if ((info.methods.size() != n_arrays) ||
+               (info.chunks.size() != n_arrays) || (n_chunks == 0)) {
+            throw std::invalid_argument("compressed snapshot needs a method "
+                  "and chunks for every array");
+         }
+         for (unsigned int a = 0; a < n_arrays; a++) {
+            if (info.chunks[a].size() != n_chunks) {
+               throw std::invalid_argument("every array of a snapshot must "
+                     "have the same number of chunks");
+            }
+            stored[a] = 0;
+            for (unsigned int c = 0; c < n_chunks; c++) {
+               info.chunks[a][c].offset = end;
+               end += info.chunks[a][c].bytes;
+               stored[a] += info.chunks[a][c].bytes;
+            }
+         }
+      } else {
+         for (unsigned int a = 0; a < n_arrays; a++) {
+            stored[a] = info.n_cells * sizeof(double);
+         }
+         end += n_arrays * stride;
+      }
+      info.offsets.resize(n_arrays);
+      for (unsigned int a = 0; a < n_arrays; a++) {
+         info.offsets[a] = compressed ? info.chunks[a][0].offset :
+            data_offset + a * stride;
+      }
+
+      std::memset(&header, 0, sizeof(header));
+      std::memcpy(header.magic, magic, sizeof(magic));
+      header.version = version;
+      header.byte_order = byte_order_mark;
+      header.step = info.step;
+      header.time = info.time;
+      header.n_cells = info.n_cells;
+      header.xmin = info.xmin;
+      header.xmax = info.xmax;
+      header.n_arrays = n_arrays;
+      header.alignment = alignment;
+      header.table_offset = sizeof(FileHeader);
+      header.data_offset = data_offset;
+      header.file_size = end;
+      header.n_chunks = n_chunks;
+      header.chunk_offset = compressed ? chunk_offset : 0;
+      std::memcpy(&bytes[0], &header, sizeof(header));
+
+      for (unsigned int a = 0; a < n_arrays; a++) {
+         if (info.names[a].size() >= sizeof(entry.name)) {
+            throw std::length_error("array name too long: " + info.names[a]);
+         }
+         std::memset(&entry, 0, sizeof(entry));
+         std::strcpy(entry.name, info.names[a].c_str());
+         entry.offset = info.offsets[a];
+         entry.count = info.n_cells;
+         entry.bytes = stored[a];
+         if (compressed) {
+            entry.filter = info.methods[a].filter;
+            entry.codec = info.methods[a].codec;
+            entry.level = info.methods[a].level;
+         }
+         std::memcpy(&bytes[sizeof(FileHeader) + a * sizeof(TableEntry)],
+               &entry, sizeof(entry));
+         for (unsigned int c = 0; c < n_chunks; c++) {
+            const Chunk &chunk = info.chunks[a][c];
+            chunk_entry.first = chunk.first;
+            chunk_entry.count = chunk.count;
+            chunk_entry.offset = chunk.offset;
+            chunk_entry.bytes = chunk.bytes;
+            std::memcpy(&bytes[chunk_offset +
+                  (a * n_chunks + c) * sizeof(ChunkEntry)],
+                  &chunk_entry, sizeof(chunk_entry));
+         }
+      }
+
+      return bytes;
+   }
+
+   // Check the fixed header
+   FileHeader check_header (const char *bytes, std::size_t n_bytes) {
+
+      FileHeader header;
+
+      if (n_bytes < sizeof(FileHeader)) {
+         throw std::ios_base::failure("snapshot header is too short");
+      }
+      std::memcpy(&header, bytes, sizeof(header));
+      if (std::memcmp(header.magic, magic, sizeof(magic)) != 0) {
+         throw std::ios_base::failure("not a snapshot file");
+      }
+      if (header.byte_order != byte_order_mark) {
+         throw std::ios_base::failure("snapshot has the wrong byte order");
+      }
+      if ((header.version < 1) || (header.version > version)) {
+         throw std::ios_base::failure("unknown snapshot version");
+      }
+      if (header.version == 1) {
+         header.n_chunks = 0;
+         header.chunk_offset = 0;
+      }
+      if ((header.table_offset < sizeof(FileHeader)) ||
+            (header.data_offset < header.table_offset +
+             header.n_arrays * sizeof(TableEntry)) ||
+            ((header.n_chunks > 0) && (header.data_offset <
+               header.chunk_offset + std::uint64_t(header.n_arrays) *
+               header.n_chunks * sizeof(ChunkEntry)))) {
+         throw std::ios_base::failure("corrupt snapshot header");
+      }
+      return header;
+   }
+
+   std::size_t header_size (const char *bytes, std::size_t n_bytes) {
+      return check_header(bytes, n_bytes).data_offset;
+   }
+
+   Info decode (const char *bytes, std::size_t n_bytes) {
+
+      FileHeader header = check_header(bytes, n_bytes);
+      TableEntry entry;
+      ChunkEntry chunk_entry;
+      Info info;
+
+      if (n_bytes < header.data_offset) {
+         throw std::ios_base::failure("snapshot header is too short");
+      }
+      info.time = header.time;
+      info.step = header.step;
+      info.n_cells = header.n_cells;
+      info.xmin = header.xmin;
+      info.xmax = header.xmax;
+      for (unsigned int a = 0; a < header.n_arrays; a++) {
+         const char *p = bytes + header.table_offset + a * sizeof(TableEntry);
+         Compress::Method method = Compress::none;
+         if (header.version == 1) {
+            TableEntryV1 v1;
+            std::memcpy(&v1, p, sizeof(v1));
+            v1.name[sizeof(v1.name)-1] = '\0';
+            std::memset(&entry, 0, sizeof(entry));
+            entry.offset = v1.offset;
+            entry.count = v1.count;
+            entry.bytes = v1.count * sizeof(double);
+            info.names.push_back(v1.name);
+         } else {
+            std::memcpy(&entry, p, sizeof(entry));
+            entry.name[sizeof(entry.name)-1] = '\0';
+            info.names.push_back(entry.name);
+            if ((entry.filter > Compress::QUANTIZE) ||
+                  (entry.codec > Compress::LZ)) {
+               throw std::ios_base::failure("unknown snapshot compression");
+            }
+            method.filter = Compress::Filter(entry.filter);
+            method.codec = Compress::Codec(entry.codec);
+            method.level = entry.level;
+         }
+         if ((entry.count != header.n_cells) ||
+               (entry.offset < header.data_offset) ||
+               (entry.offset + entry.bytes > header.file_size) ||
+               ((header.n_chunks == 0) &&
+                (entry.bytes != entry.count * sizeof(double)))) {
+            throw std::ios_base::failure("corrupt snapshot table");
+         }
+         info.offsets.push_back(entry.offset);
+         info.methods.push_back(method);
+
+         // The chunks (which must cover the array in order)
+         if (header.n_chunks > 0) {
+            std::vector<Chunk> chunks(header.n_chunks);
+            unsigned long next = 0;
+            for (unsigned int c = 0; c < header.n_chunks; c++) {
+               std::memcpy(&chunk_entry, bytes + header.chunk_offset +
+                     (a * header.n_chunks + c) * sizeof(ChunkEntry),
+                     sizeof(chunk_entry));
+               if ((chunk_entry.first != next) ||
+                     (chunk_entry.offset < header.data_offset) ||
+                     (chunk_entry.offset + chunk_entry.bytes >
+                      header.file_size)) {
+                  throw std::ios_base::failure("corrupt snapshot chunks");
+               }
+               chunks[c].first = chunk_entry.first;
+               chunks[c].count = chunk_entry.count;
+               chunks[c].offset = chunk_entry.offset;
+               chunks[c].bytes = chunk_entry.bytes;
+               next += chunk_entry.count;
+            }
+            if (next != header.n_cells) {
+               throw std::ios_base::failure("corrupt snapshot chunks");
+            }
+            info.chunks.push_back(chunks);
+         }
+      }
+      return info;
+   }
+
+   std::size_t file_size (const Info &info) {
+      const std::size_t n_arrays = info.names.size();
+      if (info.chunks.empty()) {
+         return aligned(sizeof(FileHeader) + n_arrays * sizeof(TableEntry)) +
+            n_arrays * aligned(info.n_cells * sizeof(double));
+      }
+      const Chunk &last = info.chunks.back().back();
+      return last.offset + last.bytes;
+   }
+
+   // =========================================================================
+   // Write a snapshot
+
+   void write (const std::string &filename, Info &info,
+         const std::vector<const double *> &arrays) {
+
+      const bool compressed = info.compressed();
+      std::vector< std::vector<char> > packed;
+      std::vector<char> header;
+      std::vector<char> padding(alignment, 0);
+      std::ofstream fout;
+
+      if (arrays.size() != info.names.size()) {
+         throw std::invalid_argument("one array is needed for each name");
+      }
+
+      // Compress each array as one chunk
+      info.chunks.clear();
+      if (compressed) {
+         info.chunks.assign(arrays.size(), std::vector<Chunk>(1));
+         for (unsigned int a = 0; a < arrays.size(); a++) {
+            packed.push_back(Compress::compress(arrays[a], info.n_cells,
+                     info.methods[a]));
+            info.chunks[a][0].first = 0;
+            info.chunks[a][0].count = info.n_cells;
+            info.chunks[a][0].bytes = packed[a].size();
+         }
+      }
+      header = encode(info);
+
+      fout.open(filename.c_str(), std::ios::binary | std::ios::trunc);
+      if (!fout) {
+         throw std::ios_base::failure("could not open " + filename);
+      }
+      fout.write(&header[0], header.size());
+      for (unsigned int a = 0; a < arrays.size(); a++) {
+         if (compressed) {
+            fout.write(packed[a].data(), packed[a].size());
+            continue;
+         }
+         // Pad the previous array up to the start of this one
+         padding.resize(info.offsets[a] - std::size_t(fout.tellp()));
+         fout.write(padding.data(), padding.size());
+         fout.write((const char *)arrays[a], info.n_cells * sizeof(double));
+      }
+      padding.resize(file_size(info) - std::size_t(fout.tellp()));
+      fout.write(padding.data(), padding.size());
+      if (!fout) {
+         throw std::ios_base::failure("could not write " + filename);
+      }
+   }
+
+   // =========================================================================
+   // A snapshot mapped into memory
+
+   File::File (const std::string &filename) : base(NULL), length(0) {
+
+      struct stat st;
+      void *p;
+      int fd = open(filename.c_str(), O_RDONLY);
+
+      if (fd < 0) {
+         throw std::ios_base::failure("could not open " + filename);
+      }
+      if ((fstat(fd, &st) != 0) || (st.st_size == 0)) {
+         close(fd);
+         throw std::ios_base::failure("could not read " + filename);
+      }
+      length = st.st_size;
+      p = mmap(NULL, length, PROT_READ, MAP_SHARED, fd, 0);
+      close(fd);
+      if (p == MAP_FAILED) {
+         throw std::ios_base::failure("could not map " + filename);
+      }
+      base = (const char *)p;
+
+      try {
+         file_info = decode(base, length);
+         for (unsigned int a = 0; a < file_info.names.size(); a++) {
+            if (file_info.chunks.empty() && (file_info.offsets[a] +
+                     file_info.n_cells * sizeof(double) > length)) {
+               throw std::ios_base::failure("snapshot is too short");
+            }
+            for (unsigned int c = 0; !file_info.chunks.empty() &&
+                  (c < file_info.chunks[a].size()); c++) {
+               const Chunk &chunk = file_info.chunks[a][c];
+               if (chunk.offset + chunk.bytes > length) {
+                  throw std::ios_base::failure("snapshot is too short");
+               }
+            }
+         }
+      } catch (...) {
+         munmap((void *)base, length);
+         throw;
+      }
+   }
+
+   File::~File () {
+      munmap((void *)base, length);
+   }
+
+   const double* File::array (unsigned int a) const {
+      if (a >= file_info.names.size()) {
+         throw std::out_of_range("no such array in snapshot");
+      }
+      if (!file_info.chunks.empty()) {
+         throw std::invalid_argument("array " + file_info.names[a] +
+               " is compressed and cannot be used in place");
+      }
+      return (const double *)(base + file_info.offsets[a]);
+   }
+
+   const double* File::array (const std::string &name) const {
+      int a = file_info.find(name);
+      if (a < 0) {
+         throw std::out_of_range("array missing from snapshot: " + name);
+      }
+      return array(a);
+   }
+
+   void File::read (unsigned int a, unsigned long first, unsigned long n,
+         double *values) const {
+      if (a >= file_info.names.size()) {
+         throw std::out_of_range("no such array in snapshot");
+      }
+      if (first + n > file_info.n_cells) {
+         throw std::out_of_range("cells past the end of the snapshot");
+      }
+      if (file_info.chunks.empty()) {
+         std::memcpy(values, base + file_info.offsets[a] +
+               first * sizeof(double), n * sizeof(double));
+         return;
+      }
+      read_chunks(file_info, a, first, n, values, [&] (unsigned int c) {
+            return base + file_info.chunks[a][c].offset;
+         });
+   }
+
+   // =========================================================================
+   // Delta files
+
+   const char delta_magic[8] = "TOYDELT";
+
+   // The space for each array name
+   const std::size_t delta_name_size = 32;
+
+   // A checksum of some bytes (64-bit FNV-1a)
+   std::uint64_t byte_checksum (const char *bytes, std::size_t n) {
+      std::uint64_t h = 0xcbf29ce484222325ull;
+      for (std::size_t i = 0; i < n; i++) {
+         h = (h ^ (unsigned char)bytes[i]) * 0x100000001b3ull;
+      }
+      return h;
+   }
+
+   // Count the cells stored before each stored block
+   void count_stored (DeltaInfo &info) {
+      info.stored_before.assign(1, 0);
+      for (unsigned long k = 0; k < info.blocks.size(); k++) {
+         const unsigned long b = info.blocks[k];
+         info.stored_before.push_back(info.stored_before.back() +
+               info.block_end(b) - info.block_first(b));
+      }
+   }
+
+   // Are the blocks in the grid and in increasing order?
+   bool blocks_valid (const DeltaInfo &info) {
+      for (unsigned long k = 0; k < info.blocks.size(); k++) {
+         if ((info.block_first(info.blocks[k]) >= info.n_cells) ||
+               ((k > 0) && (info.blocks[k] <= info.blocks[k-1]))) {
+            return false;
+         }
+      }
+      return true;
+   }
+
+   std::size_t DeltaInfo::offset (unsigned int a, std::size_t k) const {
+      return data_offset +
+         a * aligned(stored_before.back() * sizeof(double)) +
+         stored_before[k] * sizeof(double);
+   }
+
+   std::vector<char> encode_delta (DeltaInfo &info) {
+
+      DeltaHeader header;
+      DeltaBlock entry;
+      const std::size_t n_arrays = info.names.size();
+      const std::size_t n_blocks = info.blocks.size();
+      const std::size_t table_end = sizeof(DeltaHeader) +
+         n_arrays * delta_name_size + n_blocks * sizeof(DeltaBlock);
+      std::vector<char> bytes(aligned(table_end), 0);
+
+      if ((info.block_size == 0) || !blocks_valid(info)) {
+         throw std::invalid_argument("delta blocks must be in the grid and "
+               "in increasing order");
+      }
+      if (info.checksums.size() != n_blocks) {
+         throw std::invalid_argument("one checksum is needed for each block");
+      }
+      count_stored(info);
+      info.data_offset = bytes.size();
+
+      for (unsigned int a = 0; a < n_arrays; a++) {
+         if (info.names[a].size() >= delta_name_size) {
+            throw std::length_error("array name too long: " + info.names[a]);
+         }
+         std::strcpy(&bytes[sizeof(DeltaHeader) + a * delta_name_size],
+               info.names[a].c_str());
+      }
+      for (unsigned long k = 0; k < n_blocks; k++) {
+         entry.block = info.blocks[k];
+         entry.checksum = info.checksums[k];
+         std::memcpy(&bytes[sizeof(DeltaHeader) + n_arrays * delta_name_size +
+               k * sizeof(DeltaBlock)], &entry, sizeof(entry));
+      }
+
+      std::memset(&header, 0, sizeof(header));
+      std::memcpy(header.magic, delta_magic, sizeof(delta_magic));
+      header.version = delta_version;
+      header.byte_order = byte_order_mark;
+      header.step = info.step;
+      header.time = info.time;
+      header.n_cells = info.n_cells;
+      header.base_step = info.base_step;
+      header.full_step = info.full_step;
+      header.n_arrays = n_arrays;
+      header.block_size = info.block_size;
+      header.n_blocks = n_blocks;
+      header.data_offset = info.data_offset;
+      header.file_size = delta_file_size(info);
+      header.grid_checksum = info.grid_checksum;
+      header.table_checksum = byte_checksum(&bytes[sizeof(DeltaHeader)],
+            table_end - sizeof(DeltaHeader));
+      std::memcpy(&bytes[0], &header, sizeof(header));
+
+      return bytes;
+   }
+
+   // Check the fixed header of a delta
+   DeltaHeader check_delta_header (const char *bytes, std::size_t n_bytes) {
+
+      DeltaHeader header;
+
+      if (n_bytes < sizeof(DeltaHeader)) {
+         throw std::ios_base::failure("delta header is too short");
+      }
+      std::memcpy(&header, bytes, sizeof(header));
+      if (std::memcmp(header.magic, delta_magic, sizeof(delta_magic)) != 0) {
+         throw std::ios_base::failure("not a delta file");
+      }
+      if (header.byte_order != byte_order_mark) {
+         throw std::ios_base::failure("delta has the wrong byte order");
+      }
+      if (header.version != delta_version) {
+         throw std::ios_base::failure("unknown delta version");
+      }
+      if ((header.block_size == 0) || (header.data_offset <
+               sizeof(DeltaHeader) + header.n_arrays * delta_name_size +
+               header.n_blocks * sizeof(DeltaBlock))) {
+         throw std::ios_base::failure("corrupt delta header");
+      }
+      return header;
+   }
+
+   std::size_t delta_header_size (const char *bytes, std::size_t n_bytes) {
+      return check_delta_header(bytes, n_bytes).data_offset;
+   }
+
+   bool is_delta (const char *bytes, std::size_t n_bytes) {
+      return (n_bytes >= sizeof(delta_magic)) &&
+         (std::memcmp(bytes, delta_magic, sizeof(delta_magic)) == 0);
+   }
+
+   DeltaInfo decode_delta (const char *bytes, std::size_t n_bytes) {
+
+      DeltaHeader header = check_delta_header(bytes, n_bytes);
+      DeltaBlock entry;
+      DeltaInfo info;
+      const char *names = bytes + sizeof(DeltaHeader);
+      const char *blocks = names + header.n_arrays * delta_name_size;
+      char name[delta_name_size];
+
+      if (n_bytes < header.data_offset) {
+         throw std::ios_base::failure("delta header is too short");
+      }
+      if (byte_checksum(names, blocks - names +
+               header.n_blocks * sizeof(DeltaBlock)) !=
+            header.table_checksum) {
+         throw std::ios_base::failure("corrupt delta table");
+      }
+      info.time = header.time;
+      info.step = header.step;
+      info.n_cells = header.n_cells;
+      info.base_step = header.base_step;
+      info.full_step = header.full_step;
+      info.block_size = header.block_size;
+      info.grid_checksum = header.grid_checksum;
+      info.data_offset = header.data_offset;
+      for (unsigned int a = 0; a < header.n_arrays; a++) {
+         std::memcpy(name, names + a * delta_name_size, delta_name_size);
+         name[delta_name_size-1] = '\0';
+         info.names.push_back(name);
+      }
+      for (unsigned long k = 0; k < header.n_blocks; k++) {
+         std::memcpy(&entry, blocks + k * sizeof(DeltaBlock), sizeof(entry));
+         info.blocks.push_back(entry.block);
+         info.checksums.push_back(entry.checksum);
+      }
+      if (!blocks_valid(info)) {
+         throw std::ios_base::failure("corrupt delta table");
+      }
+      count_stored(info);
+      if (delta_file_size(info) != header.file_size) {
+         throw std::ios_base::failure("corrupt delta header");
+      }
+      return info;
+   }
+
+   std::size_t delta_file_size (const DeltaInfo &info) {
+      return info.data_offset + info.names.size() *
+         aligned(info.stored_before.back() * sizeof(double));
+   }
+
+}
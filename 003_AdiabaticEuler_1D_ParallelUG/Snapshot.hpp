@@ -0,0 +1,305 @@
+#ifndef SNAPSHOT_HPP
+#define SNAPSHOT_HPP
+
+#include "Defines.hpp"
+
+// STL includes
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// Boost includes
+
+// Includes specific to this code
+#include "Compress.hpp"
+
+// ============================================================================
+// Binary snapshot files
+//    A snapshot holds one output of the whole grid in a single file:
+// - a fixed 128-byte header (FileHeader)
+// - a table with one 64-byte entry per array (TableEntry)
+// - the arrays, each n_cells doubles, each starting on a 64-byte boundary
+// The Grid writes the cell positions as an array named "position", followed
+// by one array per variable.  All numbers are in the byte order of the
+// machine that wrote the file (checked through byte_order_mark).  Because
+// every array is contiguous and aligned, a reader can map the file into
+// memory and use the arrays where they are (see File).
+//    A compressed snapshot (see Compress.hpp) splits every array into the
+// same number of chunks (one per processor that wrote it), each compressed
+// on its own and listed in a chunk table (n_chunks ChunkEntry per array)
+// after the array table.  The chunks follow one another without padding,
+// array by array.  Any range of cells can be read by decompressing only the
+// chunks that hold it.
+//    This module does not depend on the rest of the code, so that tools can
+// use it on their own.
+
+namespace Snapshot {
+
+   // Alignment of the table and the arrays (a cache line)
+   const std::size_t alignment = 64;
+
+   // Version 2 added compression; version 1 files can still be read
+   const std::uint32_t version = 2;
+   const std::uint32_t byte_order_mark = 0x01020304;
+
+   struct FileHeader {
+      char magic[8];                // "TOYSNAP" and a null
+      std::uint32_t version;
+      std::uint32_t byte_order;     // byte_order_mark as written
+      std::uint64_t step;
+      double time;
+      std::uint64_t n_cells;
+      double xmin, xmax;
+      std::uint32_t n_arrays;
+      std::uint32_t alignment;
+      std::uint64_t table_offset;   // bytes from the start of the file
+      std::uint64_t data_offset;    // the first array
+      std::uint64_t file_size;
+      std::uint32_t n_chunks;       // chunks per array (0 = not compressed)
+      std::uint32_t unused;
+      std::uint64_t chunk_offset;   // the chunk table
+      char reserved[24];
+   };
+
+   struct TableEntry {
+      char name[32];                // null-terminated
+      std::uint64_t offset;         // bytes from the start of the file
+      std::uint64_t count;          // number of doubles
+      std::uint64_t bytes;          // bytes stored
+      std::uint8_t filter;          // Compress::Filter
+      std::uint8_t codec;           // Compress::Codec
+      std::uint8_t level;
+      char reserved[5];
+   };
+
+   struct ChunkEntry {
+      std::uint64_t first;          // first cell
+      std::uint64_t count;          // number of cells
+      std::uint64_t offset;         // bytes from the start of the file
+      std::uint64_t bytes;          // bytes stored
+   };
+
+   static_assert(sizeof(FileHeader) == 128, "FileHeader must be 128 bytes");
+   static_assert(sizeof(TableEntry) == 64, "TableEntry must be 64 bytes");
+   static_assert(sizeof(ChunkEntry) == 32, "ChunkEntry must be 32 bytes");
+
+   // Part of a compressed array
+   struct Chunk {
+      unsigned long first, count;   // the cells
+      std::size_t offset, bytes;    // where they are in the file
+   };
+
+   // What a snapshot holds (apart from the data)
+   struct Info {
+      double time;
+      unsigned long step;
+      unsigned long n_cells;
+      double xmin, xmax;
+      std::vector<std::string> names;     // one per array
+      std::vector<std::size_t> offsets;   // set by encode and decode
+
+      // Compression: one method per array (none if empty), and the chunks
+      // of each array (first, count and bytes are given to encode, which
+      // fills in the offsets)
+      std::vector<Compress::Method> methods;
+      std::vector< std::vector<Chunk> > chunks;
+
+      // The array with the given name (-1 if there is none)
+      int find (const std::string &name) const;
+
+      // Is any array compressed?
+      bool compressed () const;
+   };
+
+   // =========================================================================
+   // Header and table
+   //    encode fills in info.offsets and returns everything that comes before
+   // the first array; decode reads it back (and checks it).  header_size
+   // gives the length of that part from the first sizeof(FileHeader) bytes,
+   // so a reader knows how much more to read.
+
+   std::vector<char> encode (Info &info);
+
+   Info decode (const char *bytes, std::size_t n_bytes);
+
+   std::size_t header_size (const char *bytes, std::size_t n_bytes);
+
+   // The size of a file holding info (after encode, if it is compressed)
+   std::size_t file_size (const Info &info);
+
+   // =========================================================================
+   // Write a snapshot from one pointer per array (n_cells values each)
+   // --> A compressed snapshot is written with one chunk per array.
+
+   void write (const std::string &filename, Info &info,
+         const std::vector<const double *> &arrays);
+
+   // =========================================================================
+   // A snapshot mapped into memory (read-only)
+   //    The arrays of an uncompressed snapshot are used where they are in the
+   // file; nothing is copied.  read works for any snapshot.
+
+   class File {
+
+      public:
+
+         explicit File (const std::string &filename);
+         ~File ();
+
+         const Info& info () const {
+            return file_info;
+         }
+
+         // The values of array a (or of the named array; throws if it is
+         // missing or compressed)
+         const double* array (unsigned int a) const;
+         const double* array (const std::string &name) const;
+
+         // Copy (or decompress) cells first to first+n-1 of array a
+         void read (unsigned int a, unsigned long first, unsigned long n,
+               double *values) const;
+
+      private:
+
+         File (const File &);
+         File& operator= (const File &);
+
+         Info file_info;
+         const char *base;
+         std::size_t length;
+   };
+
+   // =========================================================================
+   // Delta files
+   //    A delta holds what changed in the grid since an earlier output (its
+   // base): the grid is split into blocks of block_size cells, and only the
+   // blocks in which some cell changed are stored.  A chain starts with a
+   // full snapshot, and each delta is based on the one before it (the first
+   // on the snapshot), so any step of the chain can be rebuilt by reading
+   // the snapshot and applying the deltas in order.  A delta file holds:
+   // - a fixed 128-byte header (DeltaHeader)
+   // - the array names (32 bytes each, null-terminated)
+   // - one DeltaBlock per stored block, in increasing order
+   // - the arrays, each holding its stored blocks one after another and
+   //   starting on an alignment boundary
+   // Each stored block has a checksum of its cells, and the header one of
+   // the whole grid after the delta is applied (to find a broken chain) and
+   // one of the names and blocks.  The checksums of cells are sums of
+   // cell_checksum over the cells, so the parts of a block (or of the grid)
+   // held by different processors can be checked separately and added up.
+
+   const std::uint32_t delta_version = 1;
+
+   struct DeltaHeader {
+      char magic[8];                // "TOYDELT" and a null
+      std::uint32_t version;
+      std::uint32_t byte_order;     // byte_order_mark as written
+      std::uint64_t step;
+      double time;
+      std::uint64_t n_cells;
+      std::uint64_t base_step;      // the output this delta changes
+      std::uint64_t full_step;      // the snapshot that starts the chain
+      std::uint32_t n_arrays;
+      std::uint32_t block_size;     // cells per block
+      std::uint64_t n_blocks;       // blocks stored
+      std::uint64_t data_offset;    // the first array
+      std::uint64_t file_size;
+      std::uint64_t grid_checksum;  // all cells, after the delta
+      std::uint64_t table_checksum; // the names and blocks
+      char reserved[24];
+   };
+
+   struct DeltaBlock {
+      std::uint64_t block;          // block number (first cell / block_size)
+      std::uint64_t checksum;       // its cells, in every array
+   };
+
+   static_assert(sizeof(DeltaHeader) == 128, "DeltaHeader must be 128 bytes");
+   static_assert(sizeof(DeltaBlock) == 16, "DeltaBlock must be 16 bytes");
+
+   // The checksum of one value (of array a at cell i of the grid)
+   inline std::uint64_t cell_checksum (std::uint64_t i, std::uint32_t a,
+         double value) {
+      std::uint64_t z;
+      std::memcpy(&z, &value, sizeof(z));
+      z ^= i * 0x9e3779b97f4a7c15ull + (a + 1) * 0xd1b54a32d192ed03ull;
+      z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+      z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+      return z ^ (z >> 31);
+   }
+
+   // What a delta holds (apart from the data)
+   struct DeltaInfo {
+      double time;
+      unsigned long step;
+      unsigned long n_cells;
+      unsigned long base_step, full_step;
+      unsigned int block_size;
+      std::vector<std::string> names;           // one per array
+      std::vector<unsigned long> blocks;        // the stored blocks
+      std::vector<std::uint64_t> checksums;     // one per stored block
+      std::uint64_t grid_checksum;
+
+      // Set by encode_delta and decode_delta: the first array, and the
+      // number of cells stored before each stored block (and after the last)
+      std::size_t data_offset;
+      std::vector<unsigned long> stored_before;
+
+      // The cells of block b (the last block may be short)
+      unsigned long block_first (unsigned long b) const {
+         return b * block_size;
+      }
+      unsigned long block_end (unsigned long b) const {
+         return (b + 1) * block_size < n_cells ? (b + 1) * block_size :
+            n_cells;
+      }
+
+      // Where the k'th stored block of array a starts in the file
+      std::size_t offset (unsigned int a, std::size_t k) const;
+   };
+
+   // Header and table (as encode and decode above); is_delta tells a delta
+   // from a snapshot by its first bytes
+   std::vector<char> encode_delta (DeltaInfo &info);
+
+   DeltaInfo decode_delta (const char *bytes, std::size_t n_bytes);
+
+   std::size_t delta_header_size (const char *bytes, std::size_t n_bytes);
+
+   bool is_delta (const char *bytes, std::size_t n_bytes);
+
+   // The size of a file holding info (after encode_delta)
+   std::size_t delta_file_size (const DeltaInfo &info);
+
+   // =========================================================================
+   // Copy cells first to first+n-1 of array a from the chunks that hold
+   // them, where chunk_bytes(c) returns a pointer to the stored bytes of
+   // chunk c (valid until the next call)
+   // --> For readers that fetch the chunks themselves (such as with MPI-IO).
+
+   template <class Fetch>
+   void read_chunks (const Info &info, unsigned int a, unsigned long first,
+         unsigned long n, double *values, Fetch chunk_bytes) {
+      std::vector<double> buffer;
+      for (unsigned int c = 0; c < info.chunks[a].size(); c++) {
+         const Chunk &chunk = info.chunks[a][c];
+         const unsigned long lo = (chunk.first > first) ? chunk.first : first;
+         const unsigned long hi = (chunk.first + chunk.count < first + n) ?
+            chunk.first + chunk.count : first + n;
+         if (lo >= hi) {
+            continue;
+         }
+         buffer.resize(chunk.count);
+         Compress::decompress(chunk_bytes(c), chunk.bytes, info.methods[a],
+               buffer.data(), chunk.count);
+         for (unsigned long i = lo; i < hi; i++) {
+            values[i - first] = buffer[i - chunk.first];
+         }
+      }
+   }
+
+}
+
+#endif // ifndef SNAPSHOT_HPP
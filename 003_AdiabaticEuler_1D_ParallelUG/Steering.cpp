@@ -0,0 +1,277 @@
+#include "Defines.hpp"
+
+// STL includes
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+// Boost includes
+
+// Other 3rd-party includes
+#ifdef PARALLEL_MPI
+#include "mpi.h"
+#endif // ifdef PARALLEL_MPI
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Includes specific to this code
+#include "Driver.hpp"
+#include "Log.hpp"
+#include "Parameters.hpp"
+#include "Steering.hpp"
+#include "Support.hpp"
+
+namespace Steering {
+
+   // Wall-clock timing
+   typedef std::chrono::steady_clock Clock;
+   typedef std::chrono::duration<double> Seconds;
+
+   // =========================================================================
+   // component-scope variables
+
+   // Poll every poll_dn steps (0 = never), reading the control file at most
+   // every poll_dt seconds
+   DelayedConst<unsigned int> poll_dn;
+   DelayedConst<double> poll_dt;
+
+   // The control file; if it is a named pipe, its descriptor and the part of
+   // a line read from it so far
+   std::string control_file;
+   int pipe_fd = -1;
+   std::string partial;
+   Clock::time_point t_read;
+
+   // Signals received since the last poll
+   volatile std::sig_atomic_t got_quit = 0;
+   volatile std::sig_atomic_t got_checkpoint = 0;
+   volatile std::sig_atomic_t got_report = 0;
+
+   // The signals handled, and the handlers they had before
+   const int signals[4] = {SIGTERM, SIGINT, SIGUSR1, SIGUSR2};
+   struct sigaction old_actions[4];
+
+   // =========================================================================
+   // Signal handler
+   // --> A second SIGTERM or SIGINT ends the run at once.
+
+   void on_signal (int sig) {
+      if (sig == SIGUSR1) {
+         got_checkpoint = 1;
+      } else if (sig == SIGUSR2) {
+         got_report = 1;
+      } else if (got_quit) {
+         std::signal(sig, SIG_DFL);
+         std::raise(sig);
+      } else {
+         got_quit = 1;
+      }
+   }
+
+   // =========================================================================
+   // Read the commands (processor 0 only)
+
+   // Add the command on one line to commands
+   void parse_command (const std::string &line, Commands &commands) {
+
+      std::stringstream ss(line);
+      std::string name;
+      double value = -1.0;
+      bool known = true;
+
+      ss >> name;
+      if (name.empty() || (name[0] == '#')) {
+         return;
+      }
+      if ((ss >> std::ws).peek() == '=') {
+         ss.get();
+      }
+      if (name == "quit") {
+         commands.quit = true;
+      } else if (name == "checkpoint") {
+         commands.checkpoint = true;
+      } else if (name == "report") {
+         commands.report = true;
+      } else if ((name == "output_dn") && (ss >> value) && (value >= 0.0)) {
+         commands.output_dn = int(value);
+      } else if ((name == "output_dt") && (ss >> value) && (value >= 0.0)) {
+         commands.output_dt = value;
+      } else {
+         known = false;
+      }
+      Log::write_single(std::string("STEERING : ") +
+            (known ? "" : "ignored ") + "\"" + line + "\"\n");
+   }
+
+   void read_commands (Commands &commands) {
+
+      char chunk[4096];
+      ssize_t n;
+      std::size_t begin = 0, end;
+
+      // A named pipe gives what has been written since the last read; a
+      // regular file is used up
+      if (pipe_fd >= 0) {
+         while ((n = read(pipe_fd, chunk, sizeof(chunk))) > 0) {
+            partial.append(chunk, n);
+         }
+      } else {
+         std::ifstream fin(control_file.c_str());
+         if (fin) {
+            partial.assign(std::istreambuf_iterator<char>(fin),
+                  std::istreambuf_iterator<char>());
+            partial += "\n";
+            fin.close();
+            std::remove(control_file.c_str());
+         }
+      }
+      while ((end = partial.find('\n', begin)) != std::string::npos) {
+         parse_command(partial.substr(begin, end - begin), commands);
+         begin = end + 1;
+      }
+      partial.erase(0, begin);
+
+      // The old way to stop a run
+      if (access("_force_quit", F_OK) == 0) {
+         commands.quit = true;
+      }
+   }
+
+   // =========================================================================
+   // Set up
+
+   void setup () {
+
+      std::stringstream ss;
+      struct sigaction action;
+      struct stat st;
+
+      poll_dn = Parameters::get_optional<unsigned int>(
+            "Steering.poll_dn", 10);
+      poll_dt = Parameters::get_optional<double>("Steering.poll_dt", 0.0);
+      control_file = Parameters::get_optional<std::string>(
+            "Steering.control_file", "_control");
+      if (poll_dt < 0.0) {
+         throw std::invalid_argument("Steering.poll_dt must not be negative");
+      }
+      if (poll_dn == 0) {
+         Log::write_single("Steering: off\n\n");
+         return;
+      }
+
+      // Catch the signals on every processor
+      std::memset(&action, 0, sizeof(action));
+      action.sa_handler = on_signal;
+      sigemptyset(&action.sa_mask);
+      action.sa_flags = SA_RESTART;
+      for (unsigned int s = 0; s < 4; s++) {
+         sigaction(signals[s], &action, &old_actions[s]);
+      }
+
+      // Keep a named pipe open (for reading and writing, so that reading
+      // does not see the end when no one is writing to it)
+#ifdef PARALLEL_MPI
+      if (Driver::proc_ID == 0) {
+#endif // ifdef PARALLEL_MPI
+         if ((stat(control_file.c_str(), &st) == 0) &&
+               S_ISFIFO(st.st_mode)) {
+            pipe_fd = open(control_file.c_str(), O_RDWR | O_NONBLOCK);
+            if (pipe_fd < 0) {
+               throw std::ios_base::failure("could not open " +
+                     control_file);
+            }
+         }
+#ifdef PARALLEL_MPI
+      }
+#endif // ifdef PARALLEL_MPI
+      t_read = Clock::now();
+
+      ss << "Steering: every " << poll_dn << " steps from the ";
+      ss << ((pipe_fd >= 0) ? "named pipe " : "file ") << control_file;
+      if (poll_dt > 0.0) {
+         ss << " (read at most every " << poll_dt << " s)";
+      }
+      ss << " and signals" << std::endl << std::endl;
+      Log::write_single(ss.str());
+   }
+
+   // =========================================================================
+   // Clean up
+
+   void cleanup () {
+      if (poll_dn == 0) {
+         return;
+      }
+      for (unsigned int s = 0; s < 4; s++) {
+         sigaction(signals[s], &old_actions[s], NULL);
+      }
+      if (pipe_fd >= 0) {
+         close(pipe_fd);
+         pipe_fd = -1;
+      }
+   }
+
+   // =========================================================================
+   // Poll for commands
+   //    Processor 0 reads the control channel; the signals may come to any
+   // processor.  One reduction (the largest of each value, with "unchanged"
+   // the smallest) gives every processor the same commands.
+
+   Commands poll (unsigned int n_step) {
+
+      Commands commands = {false, false, false, -1, -1.0};
+      double values[5];
+
+      if ((poll_dn == 0) || (n_step % poll_dn != 0)) {
+         return commands;
+      }
+
+#ifdef PARALLEL_MPI
+      if (Driver::proc_ID == 0) {
+#endif // ifdef PARALLEL_MPI
+         if (Seconds(Clock::now() - t_read).count() >= poll_dt) {
+            t_read = Clock::now();
+            read_commands(commands);
+         }
+#ifdef PARALLEL_MPI
+      }
+#endif // ifdef PARALLEL_MPI
+      if (got_quit) {
+         commands.quit = true;
+      }
+      if (got_checkpoint) {
+         got_checkpoint = 0;
+         commands.checkpoint = true;
+      }
+      if (got_report) {
+         got_report = 0;
+         commands.report = true;
+      }
+
+      values[0] = commands.quit ? 1.0 : 0.0;
+      values[1] = commands.checkpoint ? 1.0 : 0.0;
+      values[2] = commands.report ? 1.0 : 0.0;
+      values[3] = commands.output_dn;
+      values[4] = commands.output_dt;
+#ifdef PARALLEL_MPI
+      MPI_Allreduce(MPI_IN_PLACE, values, 5, MPI_DOUBLE, MPI_MAX,
+            MPI_COMM_WORLD);
+#endif // ifdef PARALLEL_MPI
+      commands.quit = (values[0] > 0.0);
+      commands.checkpoint = (values[1] > 0.0);
+      commands.report = (values[2] > 0.0);
+      commands.output_dn = int(values[3]);
+      commands.output_dt = values[4];
+
+      return commands;
+   }
+
+}
@@ -0,0 +1,60 @@
+#ifndef STEERING_HPP
+#define STEERING_HPP
+
+#include "Defines.hpp"
+
+// STL includes
+
+// Boost includes
+
+// Includes specific to this code
+
+// ============================================================================
+// Steering a running simulation
+//    Every poll_dn steps, processor 0 looks for commands and passes them on
+// to the others, so that one processor (rather than every processor on
+// every step) touches the file system.  Commands come from:
+// - the control file (Steering.control_file), one command per line; a
+//   regular file is read and then removed (write it elsewhere and move it
+//   into place, so it is never read half-written), and a named pipe
+//   (mkfifo) is kept open and read as commands arrive
+// - the file _force_quit, as before (quit while it exists)
+// - signals, on any processor: SIGTERM and SIGINT (quit), SIGUSR1
+//   (checkpoint) and SIGUSR2 (timing report)
+// The commands are:
+//    quit              stop, after writing the output
+//    checkpoint        write the output now
+//    report            write a timing report to the log
+//    output_dn <n>     write the output every n steps (0 = not by steps)
+//    output_dt <t>     write the output every t (0 = not by time)
+
+namespace Steering {
+
+   // What one poll found
+   struct Commands {
+      bool quit;
+      bool checkpoint;
+      bool report;
+      int output_dn;       // new Driver output_dn (negative = unchanged)
+      double output_dt;    // new Driver output_dt (negative = unchanged)
+   };
+
+   // =========================================================================
+   // Set up
+
+   void setup ();
+
+   // =========================================================================
+   // Clean up
+
+   void cleanup ();
+
+   // =========================================================================
+   // Poll for commands at step n_step (every processor calls this on every
+   // step; nothing is done except every poll_dn steps)
+
+   Commands poll (unsigned int n_step);
+
+}
+
+#endif // ifndef STEERING_HPP
@@ -30,6 +30,14 @@ class DelayedConst {
          return *this; 
       }
 
+      // Change the value once it is set
+      // --> Only for the few values that are changed deliberately, such as
+      //     the local grid limits when the load is rebalanced
+      void reset (T v) {
+         assert(assigned);
+         val = v;
+      }
+
       // Read the value
       operator T() const { 
          assert(assigned); 
@@ -0,0 +1,45 @@
+#include "Defines.hpp"
+
+// STL includes
+#include <charconv>
+#include <cstring>
+
+// Boost includes
+
+// Includes specific to this code
+#include "TextFormat.hpp"
+
+namespace TextFormat {
+
+   char* format_value (char *out, double value) {
+      // A value takes at most width characters (sign, digit, point, width-8
+      // digits, and an exponent of up to three digits)
+      char digits[2 * width];
+      const std::to_chars_result r = std::to_chars(digits,
+            digits + sizeof(digits), value, std::chars_format::scientific,
+            width - 8);
+      const std::size_t n = r.ptr - digits;
+      if (n < width) {
+         std::memset(out, ' ', width - n);
+         out += width - n;
+      }
+      std::memcpy(out, digits, n);
+      return out + n;
+   }
+
+   char* format_rows (char *out, const double *const *columns,
+         unsigned int n_columns, std::size_t first, std::size_t last) {
+      for (std::size_t i = first; i < last; i++) {
+         for (unsigned int c = 0; c < n_columns; c++) {
+            if (c > 0) {
+               std::memcpy(out, "   ", 3);
+               out += 3;
+            }
+            out = format_value(out, columns[c][i]);
+         }
+         *out++ = '\n';
+      }
+      return out;
+   }
+
+}
@@ -0,0 +1,44 @@
+#ifndef TEXTFORMAT_HPP
+#define TEXTFORMAT_HPP
+
+#include "Defines.hpp"
+
+// STL includes
+#include <cstddef>
+
+// Boost includes
+
+// Includes specific to this code
+
+// ============================================================================
+// Fast formatting of the text output
+//    The text output has one row per cell: the position and then each
+// variable, each value in scientific notation with width-8 digits after the
+// point, right-aligned in width characters, separated by three spaces.
+// This is what a stream prints with precision(width-8), std::scientific and
+// std::setw(width); here the values are printed with std::to_chars (which
+// rounds the same way) straight into a buffer, which is many times faster.
+// Like Snapshot, this module does not depend on the rest of the code.
+
+namespace TextFormat {
+
+   // The width of each value
+   const unsigned int width = 30;
+
+   // The most bytes a row of n_columns values can take (with its newline)
+   inline std::size_t max_row_bytes (unsigned int n_columns) {
+      return n_columns * (width + 3) - 2;
+   }
+
+   // Print one value (padded to width); returns the end of what was printed
+   char* format_value (char *out, double value);
+
+   // Print rows first to last-1 of n_columns columns; out must have room for
+   // (last - first) * max_row_bytes(n_columns) bytes.  Returns the end of
+   // what was printed.
+   char* format_rows (char *out, const double *const *columns,
+         unsigned int n_columns, std::size_t first, std::size_t last);
+
+}
+
+#endif // ifndef TEXTFORMAT_HPP
@@ -0,0 +1,408 @@
+#include "Defines.hpp"
+
+// STL includes
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <iomanip>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Boost includes
+
+// Other 3rd-party includes
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif // ifdef __linux__
+
+// Includes specific to this code
+#include "Driver.hpp"
+#include "Log.hpp"
+#include "Parameters.hpp"
+#include "Support.hpp"
+#include "Threads.hpp"
+
+namespace Threads {
+
+   // Wall-clock timing
+   typedef std::chrono::steady_clock Clock;
+   typedef std::chrono::duration<double> Seconds;
+
+   // =========================================================================
+   // component-scope variables
+
+   // Number of threads per process (including the main thread)
+   DelayedConst<unsigned int> n_threads;
+
+   // The smallest number of cells worth giving to a thread
+   DelayedConst<unsigned int> min_chunk;
+
+   // Pin each thread to one CPU
+   DelayedConst<bool> pin;
+
+   // The CPUs this process may run on (thread t is pinned to cpus[t])
+   std::vector<int> cpus;
+
+   // The pool
+   // --> Each call to run starts a new generation; the workers that take part
+   //     in it count down n_pending when they finish.
+   std::vector<std::thread> workers;
+   std::mutex pool_mutex;
+   std::condition_variable start_cv, done_cv;
+   unsigned long generation = 0;
+   unsigned int n_active = 0;
+   unsigned int n_pending = 0;
+   bool stopping = false;
+   const Task *current = NULL;
+
+   // Time spent running tasks, per thread, and the time spent in run
+   std::vector<double> busy;
+   double t_run = 0.0;
+
+   // =========================================================================
+   // Pin the calling thread to its CPU
+
+   void pin_thread (unsigned int t) {
+#ifdef __linux__
+      if (pin && !cpus.empty()) {
+         cpu_set_t set;
+         CPU_ZERO(&set);
+         CPU_SET(cpus[t % cpus.size()], &set);
+         pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+      }
+#endif // ifdef __linux__
+   }
+
+   // =========================================================================
+   // The loop run by each pool thread
+
+   void worker (unsigned int t) {
+
+      unsigned long seen = 0;
+      const Task *task;
+      Clock::time_point t0;
+
+      pin_thread(t);
+
+      while (true) {
+         // Wait for a new task
+         std::unique_lock<std::mutex> lock(pool_mutex);
+         start_cv.wait(lock, [&] { return stopping || generation != seen; });
+         if (stopping) {
+            return;
+         }
+         seen = generation;
+         if (t >= n_active) {
+            continue;
+         }
+         task = current;
+         lock.unlock();
+
+         // Run it
+         t0 = Clock::now();
+         (*task)(t);
+         busy[t] += Seconds(Clock::now() - t0).count();
+
+         // Report that it is done
+         lock.lock();
+         n_pending--;
+         if (n_pending == 0) {
+            done_cv.notify_one();
+         }
+      }
+   }
+
+   // =========================================================================
+   // Set up
+
+   void setup () {
+
+      std::stringstream ss;
+      unsigned int n;
+
+      Log::write_single(std::string(79,'_') + "\n");
+      Log::write_single("Threads Setup:\n\n");
+
+      // The CPUs this process may use (MPI launchers often restrict them)
+#ifdef __linux__
+      cpu_set_t set;
+      if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+         for (int c = 0; c < CPU_SETSIZE; c++) {
+            if (CPU_ISSET(c, &set)) {
+               cpus.push_back(c);
+            }
+         }
+      }
+#endif // ifdef __linux__
+
+      // Number of threads (0 = one per available CPU)
+      n = Parameters::get_optional<unsigned int>("Threads.n_threads", 1);
+      if (n == 0) {
+         n = cpus.empty() ? std::thread::hardware_concurrency() : cpus.size();
+         n = (n > 0) ? n : 1;
+      }
+      n_threads = n;
+
+      // Don't split ranges finer than this
+      min_chunk = Parameters::get_optional<unsigned int>(
+            "Threads.min_chunk", 256);
+      if (min_chunk == 0) {
+         throw std::invalid_argument("Threads.min_chunk must be positive");
+      }
+
+      // Pinning
+      pin = Parameters::get_optional<bool>("Threads.pin", false);
+
+      // Start the pool
+      busy.assign(n_threads, 0.0);
+      pin_thread(0);
+      for (unsigned int t = 1; t < n_threads; t++) {
+         workers.push_back(std::thread(worker, t));
+      }
+
+      ss << "Threads per process: " << n_threads;
+      ss << " (at least " << min_chunk << " cells each)" << std::endl;
+      Log::write_single(ss.str());
+      if (pin) {
+         ss.clear();
+         ss.str("");
+#ifdef PARALLEL_MPI
+         ss << "Process " << std::setw(Driver::p_width) << Driver::proc_ID;
+         ss << " : ";
+#endif // ifdef PARALLEL_MPI
+         ss << "threads pinned to CPUs";
+         for (unsigned int t = 0; t < n_threads; t++) {
+            ss << " " << (cpus.empty() ? -1 : cpus[t % cpus.size()]);
+         }
+         ss << std::endl;
+         Log::write_all(ss.str());
+      }
+      Log::write_single("\n");
+   }
+
+   // =========================================================================
+   // Clean up
+
+   void cleanup () {
+
+      std::stringstream ss;
+      double max_busy = 0.0, sum_busy = 0.0;
+
+      // Stop the pool
+      {
+         std::lock_guard<std::mutex> lock(pool_mutex);
+         stopping = true;
+      }
+      start_cv.notify_all();
+      for (unsigned int t = 0; t < workers.size(); t++) {
+         workers[t].join();
+      }
+      workers.clear();
+
+      // Report the load balance: the time each thread spent working, as a
+      // fraction of the time spent in threaded regions
+      if (n_threads > 1) {
+         Log::write_single(std::string(79,'_') + "\n");
+         Log::write_single("Thread Load Balance:\n\n");
+         for (unsigned int t = 0; t < n_threads; t++) {
+            max_busy = (busy[t] > max_busy) ? busy[t] : max_busy;
+            sum_busy += busy[t];
+         }
+#ifdef PARALLEL_MPI
+         ss << "Process " << std::setw(Driver::p_width) << Driver::proc_ID;
+         ss << " :";
+#endif // ifdef PARALLEL_MPI
+         ss << std::fixed << std::setprecision(1);
+         for (unsigned int t = 0; t < n_threads; t++) {
+            ss << " " << std::setw(5);
+            ss << ((t_run > 0.0) ? 100.0 * busy[t] / t_run : 0.0) << "%";
+         }
+         ss << " busy; imbalance (max/mean) " << std::setprecision(3);
+         ss << ((sum_busy > 0.0) ? max_busy * n_threads / sum_busy : 1.0);
+         ss << std::endl;
+         Log::write_all(ss.str());
+         Log::write_single("\n");
+      }
+   }
+
+   // =========================================================================
+   // Run a task on threads 0 to n_used-1
+
+   void run (unsigned int n_used, const Task &task) {
+
+      Clock::time_point t0, t1;
+
+      n_used = (n_used < n_threads) ? n_used : n_threads;
+      n_used = (n_used > 0) ? n_used : 1;
+
+      t0 = Clock::now();
+      if (n_used > 1) {
+         // Hand the task to the pool
+         {
+            std::lock_guard<std::mutex> lock(pool_mutex);
+            current = &task;
+            n_active = n_used;
+            n_pending = n_used - 1;
+            generation++;
+         }
+         start_cv.notify_all();
+      }
+
+      // Do this thread's part
+      t1 = Clock::now();
+      task(0);
+      busy[0] += Seconds(Clock::now() - t1).count();
+
+      if (n_used > 1) {
+         // Wait for the others
+         std::unique_lock<std::mutex> lock(pool_mutex);
+         done_cv.wait(lock, [] { return n_pending == 0; });
+         current = NULL;
+      }
+      t_run += Seconds(Clock::now() - t0).count();
+   }
+
+   // =========================================================================
+   // How many threads to use for n_cells cells
+
+   unsigned int threads_for (int n_cells) {
+      unsigned int n = (n_cells > 0) ? n_cells / min_chunk : 0;
+      n = (n < n_threads) ? n : n_threads;
+      return (n > 0) ? n : 1;
+   }
+
+   // =========================================================================
+   // Task graph
+
+   // A ready queue per thread, kept from one execute to the next
+   // --> The owner pushes and pops at the back; thieves take from the front.
+   struct ReadyQueue {
+      std::mutex mutex;
+      std::deque<unsigned int> ids;
+   };
+   std::deque<ReadyQueue> *ready = NULL;
+   std::deque<ReadyQueue> ready_queues;
+
+   void push_ready (unsigned int t, unsigned int id) {
+      std::lock_guard<std::mutex> lock((*ready)[t].mutex);
+      (*ready)[t].ids.push_back(id);
+   }
+
+   bool pop_ready (unsigned int t, unsigned int &id) {
+      std::lock_guard<std::mutex> lock((*ready)[t].mutex);
+      if ((*ready)[t].ids.empty()) {
+         return false;
+      }
+      id = (*ready)[t].ids.back();
+      (*ready)[t].ids.pop_back();
+      return true;
+   }
+
+   bool steal_ready (unsigned int t, unsigned int &id) {
+      const unsigned int n = ready->size();
+      for (unsigned int k = 1; k < n; k++) {
+         ReadyQueue &victim = (*ready)[(t + k) % n];
+         std::lock_guard<std::mutex> lock(victim.mutex);
+         if (!victim.ids.empty()) {
+            id = victim.ids.front();
+            victim.ids.pop_front();
+            return true;
+         }
+      }
+      return false;
+   }
+
+   void TaskGraph::clear () {
+      nodes.clear();
+   }
+
+   unsigned int TaskGraph::add (Work work) {
+      nodes.emplace_back(work, false);
+      return nodes.size() - 1;
+   }
+
+   unsigned int TaskGraph::add_event () {
+      nodes.emplace_back(Work(), true);
+      return nodes.size() - 1;
+   }
+
+   void TaskGraph::depend (unsigned int before, unsigned int after) {
+      nodes[before].next.push_back(after);
+      nodes[after].n_depends++;
+   }
+
+   void TaskGraph::complete_event (unsigned int event) {
+      finish(event, 0);
+   }
+
+   // A task (or event) is done: release the tasks waiting for it
+   void TaskGraph::finish (unsigned int id, unsigned int t) {
+      const std::vector<unsigned int> &next = nodes[id].next;
+      for (unsigned int k = 0; k < next.size(); k++) {
+         if (--nodes[next[k]].n_waiting == 0) {
+            push_ready(t, next[k]);
+         }
+      }
+      remaining--;
+   }
+
+   void TaskGraph::execute (const std::function<void()> &poll) {
+
+      std::vector<double> idle(n_threads, 0.0);
+      unsigned int k = 0;
+
+      // Deal out the tasks that are ready from the start
+      while (ready_queues.size() < n_threads) {
+         ready_queues.emplace_back();
+      }
+      ready = &ready_queues;
+      remaining = nodes.size();
+      for (unsigned int id = 0; id < nodes.size(); id++) {
+         nodes[id].n_waiting = nodes[id].n_depends;
+         if ((nodes[id].n_depends == 0) && !nodes[id].event) {
+            ready_queues[k % n_threads].ids.push_back(id);
+            k++;
+         }
+      }
+
+      // Run them
+      run(n_threads, [&] (unsigned int t) {
+         unsigned int id;
+         bool waiting = false;
+         Clock::time_point t_idle;
+         while (remaining > 0) {
+            if (pop_ready(t, id) || steal_ready(t, id)) {
+               if (waiting) {
+                  idle[t] += Seconds(Clock::now() - t_idle).count();
+                  waiting = false;
+               }
+               nodes[id].work();
+               finish(id, t);
+            } else if (!waiting) {
+               waiting = true;
+               t_idle = Clock::now();
+            } else if (t != 0) {
+               std::this_thread::yield();
+            }
+            if (t == 0) {
+               poll();
+            }
+         }
+         if (waiting) {
+            idle[t] += Seconds(Clock::now() - t_idle).count();
+         }
+      });
+      ready = NULL;
+
+      // Only count the time spent on tasks toward the load balance
+      for (unsigned int t = 0; t < n_threads; t++) {
+         busy[t] -= idle[t];
+      }
+   }
+
+}
@@ -0,0 +1,171 @@
+#ifndef THREADS_HPP
+#define THREADS_HPP
+
+#include "Defines.hpp"
+
+// STL includes
+#include <atomic>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <vector>
+
+// Boost includes
+
+// Includes specific to this code
+#include "Support.hpp"
+
+// ============================================================================
+// Thread pool for shared-memory parallelism within a processor
+//    The pool holds n_threads threads (the calling thread is thread 0 and
+// the rest wait in the pool).  A task is run by every thread at once, each
+// with its own thread number, and usually works on the part of a cell range
+// given by split.  Only thread 0 (the one running the Driver) may call MPI.
+
+namespace Threads {
+
+   // component-scope variables
+   extern DelayedConst<unsigned int> n_threads;
+
+   // The smallest number of cells worth giving to a thread
+   extern DelayedConst<unsigned int> min_chunk;
+
+   // A task run by each thread (the argument is the thread number)
+   typedef std::function<void(unsigned int)> Task;
+
+   // =========================================================================
+   // Set up
+
+   void setup ();
+
+   // =========================================================================
+   // Clean up
+
+   void cleanup ();
+
+   // =========================================================================
+   // Run a task on threads 0 to n_used-1 and wait for all of them to finish
+
+   void run (unsigned int n_used, const Task &task);
+
+   // =========================================================================
+   // Split a range of cells
+   //    Part t of n of the range lo to hi-1 starts at split(lo, hi, t, n) and
+   // ends before split(lo, hi, t+1, n).
+
+   inline int split (int lo, int hi, unsigned int t, unsigned int n) {
+      return lo + int((long long)(hi - lo) * t / n);
+   }
+
+   // How many threads to use for n_cells cells (at least 1)
+   unsigned int threads_for (int n_cells);
+
+   // =========================================================================
+   // Task graph with a work-stealing scheduler
+   //    Tasks are added with the tasks they must wait for; execute runs them
+   // on all threads.  Each thread keeps its own queue of ready tasks, takes
+   // the newest task from its own queue, and when that is empty steals the
+   // oldest task from another thread's queue, so idle threads pick up work
+   // wherever it is.  A task that becomes ready goes to the queue of the
+   // thread that finished its last dependency, which keeps neighboring work
+   // on the same core.
+   //    An event is a task without work that is completed from outside, by
+   // calling complete_event from the poll function.  Thread 0 calls poll
+   // between tasks and whenever it is idle, so it can check for things only
+   // it may check for (such as MPI messages).  The graph must not wait
+   // forever: poll has to complete every event eventually.
+   //    A graph can be executed any number of times (each time, every task
+   // waits for its dependencies again), so a caller whose tasks do not
+   // change can build the graph once.
+
+   class TaskGraph {
+
+      public:
+
+         typedef std::function<void()> Work;
+
+         // Remove all tasks (to build a new graph)
+         void clear ();
+
+         // Add a task or an event; returns its ID
+         unsigned int add (Work work);
+         unsigned int add_event ();
+
+         // Task after waits for task before to finish
+         void depend (unsigned int before, unsigned int after);
+
+         // Mark an event as happened (only from poll)
+         void complete_event (unsigned int event);
+
+         // Run all tasks and return when they are all finished
+         void execute (const std::function<void()> &poll);
+
+         // The number of tasks and events
+         unsigned int size () const {
+            return nodes.size();
+         }
+
+      private:
+
+         struct Node {
+            Work work;
+            bool event;
+            int n_depends;                   // dependencies
+            std::atomic<int> n_waiting;      // unfinished dependencies
+            std::vector<unsigned int> next;  // tasks waiting for this one
+            Node (Work w, bool e) :
+               work(w), event(e), n_depends(0), n_waiting(0) {}
+         };
+
+         void finish (unsigned int id, unsigned int t);
+
+         std::deque<Node> nodes;
+         std::atomic<unsigned int> remaining;
+   };
+
+   // =========================================================================
+   // Bounded single-producer, single-consumer queue
+   //    One thread pushes and one other thread pops, without locks.  push
+   // returns false when the queue is full and pop when it is empty; the
+   // caller decides how to wait.
+
+   template <class T>
+   class SpscQueue {
+
+      public:
+
+         explicit SpscQueue (std::size_t capacity)
+            : slots(capacity + 1), head(0), tail(0) {}
+
+         bool push (const T &value) {
+            const std::size_t t = tail.load(std::memory_order_relaxed);
+            const std::size_t next = (t + 1) % slots.size();
+            if (next == head.load(std::memory_order_acquire)) {
+               return false;
+            }
+            slots[t] = value;
+            tail.store(next, std::memory_order_release);
+            return true;
+         }
+
+         bool pop (T &value) {
+            const std::size_t h = head.load(std::memory_order_relaxed);
+            if (h == tail.load(std::memory_order_acquire)) {
+               return false;
+            }
+            value = slots[h];
+            head.store((h + 1) % slots.size(), std::memory_order_release);
+            return true;
+         }
+
+      private:
+
+         std::vector<T> slots;
+         // On separate cache lines, so the two threads do not fight over them
+         alignas(64) std::atomic<std::size_t> head;   // next to pop
+         alignas(64) std::atomic<std::size_t> tail;   // next to push
+   };
+
+}
+
+#endif // ifndef THREADS_HPP
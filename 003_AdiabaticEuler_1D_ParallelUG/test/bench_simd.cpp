@@ -0,0 +1,87 @@
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+#include "HydroSimd.hpp"
+
+// Benchmark the vectorized Hydro loops: run the flux and update loops of the
+// fused kernel over a unit-stride array with each instruction set, report the
+// cell updates per second, and check that every version gives exactly the
+// same result as the plain C++ version.
+//
+// Usage: bench_simd [cells] [steps]
+
+namespace Simd = Hydro::Simd;
+
+// One step over the whole array, in blocks like the fused kernel
+void step (const Simd::Isa &isa, std::vector<double> &q, double v,
+      double dt_dx) {
+   const int block = 64;
+   const int n = q.size();
+   double dQ[block+1];
+   dQ[0] = 0.0;
+   for (int b = 0; b < n; b += block) {
+      int e = (b + block < n) ? b + block : n;
+      isa.flux(&q[b], &dQ[1], e-b, v, dt_dx);
+      if (e == n) {
+         dQ[e-b] = 0.0;
+      }
+      double carry = dQ[e-b];
+      isa.update(&q[b], dQ, e-b);
+      dQ[0] = carry;
+   }
+}
+
+int main (int argc, char *argv[]) {
+
+   int n_cells = (argc > 1) ? atoi(argv[1]) : 4096;
+   int n_steps = (argc > 2) ? atoi(argv[2]) : 20000;
+   const double v = 500.0;
+   const double dt_dx = 0.8 / v;
+   std::vector<double> reference;
+   double base_rate = 0.0;
+   int errors = 0;
+
+   std::cout << n_cells << " cells, " << n_steps << " steps" << std::endl;
+   for (int i = 0; i < Simd::n_isa; i++) {
+      const Simd::Isa &isa = Simd::isa(i);
+      std::cout << "  " << std::left << std::setw(8) << isa.name;
+      if (!Simd::supported(i)) {
+         std::cout << "not supported" << std::endl;
+         continue;
+      }
+
+      std::vector<double> q(n_cells);
+      for (int c = 0; c < n_cells; c++) {
+         q[c] = 10.0 + 1.25 * exp(-pow((c - 0.5*n_cells) / (0.1*n_cells), 2));
+      }
+
+      std::chrono::steady_clock::time_point t0, t1;
+      t0 = std::chrono::steady_clock::now();
+      for (int s = 0; s < n_steps; s++) {
+         step(isa, q, v, dt_dx);
+      }
+      t1 = std::chrono::steady_clock::now();
+      double secs = std::chrono::duration<double>(t1 - t0).count();
+      double rate = double(n_cells) * n_steps / secs;
+
+      bool same = true;
+      if (i == 0) {
+         reference = q;
+         base_rate = rate;
+      } else if (q != reference) {
+         same = false;
+         errors++;
+      }
+
+      std::cout << std::scientific << std::setprecision(3) << rate;
+      std::cout << " cell updates/s";
+      std::cout << std::fixed << std::setprecision(2);
+      std::cout << "  (x" << rate / base_rate << " scalar)";
+      std::cout << (same ? "" : "  MISMATCH") << std::endl;
+   }
+
+   return (errors == 0) ? 0 : 1;
+}
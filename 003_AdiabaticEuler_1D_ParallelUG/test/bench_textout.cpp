@@ -0,0 +1,151 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "TextFormat.hpp"
+
+// Benchmark the text output: write a grid of cells (the position and three
+// variables) with the stream formatting that Grid used to use, then with
+// TextFormat on one thread and on several threads (a block of rows each,
+// written in order with large writes), report the bytes written per second,
+// and check that every file is exactly the same as the one from the streams.
+//
+// Usage: bench_textout [cells] [threads]
+
+const unsigned int n_columns = 4;
+const std::size_t block = 8192;
+
+// The text output as Grid::write_data used to print it
+void write_stream (const std::string &filename,
+      const std::vector<const double *> &columns, std::size_t n) {
+   const unsigned int w = TextFormat::width;
+   std::ofstream fout(filename.c_str());
+   fout.precision(w-8);
+   fout.setf(std::ios::scientific);
+   for (std::size_t i = 0; i < n; i++) {
+      fout << std::setw(w) << columns[0][i];
+      for (unsigned int c = 1; c < n_columns; c++) {
+         fout << "   " << std::setw(w) << columns[c][i];
+      }
+      fout << std::endl;
+   }
+}
+
+// The text output as Grid::emit_frame prints it
+void write_fast (const std::string &filename,
+      const std::vector<const double *> &columns, std::size_t n,
+      unsigned int n_threads) {
+   std::vector< std::vector<char> > buffers(n_threads);
+   std::vector<std::size_t> lengths(n_threads);
+   for (unsigned int t = 0; t < n_threads; t++) {
+      buffers[t].resize(block * TextFormat::max_row_bytes(n_columns));
+   }
+   FILE *file = std::fopen(filename.c_str(), "wb");
+   std::setvbuf(file, NULL, _IONBF, 0);
+   for (std::size_t row = 0; row < n; row += block * n_threads) {
+      auto format = [&] (unsigned int t) {
+         const std::size_t first = std::min(n, row + t * block);
+         const std::size_t last = std::min(n, first + block);
+         lengths[t] = TextFormat::format_rows(buffers[t].data(),
+               columns.data(), n_columns, first, last) - buffers[t].data();
+      };
+      std::vector<std::thread> threads;
+      for (unsigned int t = 1; t < n_threads; t++) {
+         threads.push_back(std::thread(format, t));
+      }
+      format(0);
+      for (unsigned int t = 0; t < threads.size(); t++) {
+         threads[t].join();
+      }
+      for (unsigned int t = 0; t < n_threads; t++) {
+         std::fwrite(buffers[t].data(), 1, lengths[t], file);
+      }
+   }
+   std::fclose(file);
+}
+
+std::string contents (const std::string &filename) {
+   std::ifstream fin(filename.c_str(), std::ios::binary);
+   std::ostringstream out;
+   out << fin.rdbuf();
+   return out.str();
+}
+
+int main (int argc, char *argv[]) {
+
+   std::size_t n_cells = (argc > 1) ? atol(argv[1]) : 1000000;
+   unsigned int n_threads = (argc > 2) ? atoi(argv[2]) :
+      std::max(1u, std::thread::hardware_concurrency());
+   std::vector< std::vector<double> > values(n_columns,
+         std::vector<double>(n_cells));
+   std::vector<const double *> columns(n_columns);
+   int errors = 0;
+
+   for (std::size_t i = 0; i < n_cells; i++) {
+      const double x = -250.0 + 500.0 * (i + 0.5) / n_cells;
+      values[0][i] = x;
+      values[1][i] = 10.0 + 1.25 * exp(-pow(x / 50.0, 2));
+      values[2][i] = (std::fabs(x) < 50.0) ? 10.0 + 1.25 * (1.0 - x*x/2500.0)
+         : 10.0;
+      values[3][i] = (std::fabs(x) < 50.0) ? 11.25 : 10.0;
+   }
+   for (unsigned int c = 0; c < n_columns; c++) {
+      columns[c] = values[c].data();
+   }
+
+   std::cout << n_cells << " cells" << std::endl;
+   const std::string reference = "bench_textout_stream.dat";
+   double base_rate = 0.0;
+   std::string expected;
+   for (int version = 0; version < 3; version++) {
+      const unsigned int used = (version == 2) ? n_threads : 1;
+      std::string filename = reference;
+      std::ostringstream name;
+      if (version == 0) {
+         name << "streams";
+      } else {
+         name << "TextFormat, " << used << " thread" << (used > 1 ? "s" : "");
+         filename = "bench_textout_fast.dat";
+      }
+      std::cout << "  " << std::left << std::setw(24) << name.str();
+
+      std::chrono::steady_clock::time_point t0, t1;
+      t0 = std::chrono::steady_clock::now();
+      if (version == 0) {
+         write_stream(filename, columns, n_cells);
+      } else {
+         write_fast(filename, columns, n_cells, used);
+      }
+      t1 = std::chrono::steady_clock::now();
+      double secs = std::chrono::duration<double>(t1 - t0).count();
+
+      const std::string written = contents(filename);
+      double rate = written.size() / secs;
+      bool same = true;
+      if (version == 0) {
+         expected = written;
+         base_rate = rate;
+      } else {
+         same = (written == expected);
+         errors += same ? 0 : 1;
+         std::remove(filename.c_str());
+      }
+
+      std::cout << std::fixed << std::setprecision(1) << rate / 1.0e6;
+      std::cout << " MB/s";
+      std::cout << std::setprecision(2);
+      std::cout << "  (x" << rate / base_rate << " streams)";
+      std::cout << (same ? "" : "  MISMATCH") << std::endl;
+   }
+   std::remove(reference.c_str());
+
+   return (errors == 0) ? 0 : 1;
+}
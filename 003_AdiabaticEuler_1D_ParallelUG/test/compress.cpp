@@ -0,0 +1,149 @@
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+#include "Compress.hpp"
+
+// Compress and decompress several kinds of data with every filter, coder, and
+// a few levels, and check that every bit comes back (compared as integers,
+// so NaNs and signed zeros count).  Then check that damaged data is rejected.
+
+bool same_bits (const std::vector<double> &a, const std::vector<double> &b) {
+   return (a.size() == b.size()) && ((a.size() == 0) ||
+         (std::memcmp(a.data(), b.data(), a.size() * sizeof(double)) == 0));
+}
+
+int main () {
+
+   const char *filters[] = {"none", "shuffle", "xor"};
+   std::vector<std::string> codecs;
+   const int levels[] = {0, 1, 6, 9};
+   std::vector< std::vector<double> > inputs(6);
+   int errors = 0;
+
+   codecs.push_back("lz");
+   if (Compress::have_zlib()) {
+      codecs.push_back("zlib");
+   }
+
+   // Empty, a single value, a smooth field, a step, noise, and odd values
+   inputs[1].push_back(3.25);
+   for (int i = 0; i < 5000; i++) {
+      double x = (i - 2500) / 500.0;
+      inputs[2].push_back(10.0 + std::exp(-x*x));
+      inputs[3].push_back((i < 2000) ? 1.0 : 0.125);
+   }
+   std::uint64_t state = 12345;
+   for (int i = 0; i < 3000; i++) {
+      state = state * 6364136223846793005ull + 1442695040888963407ull;
+      double v;
+      std::memcpy(&v, &state, sizeof(v));
+      inputs[4].push_back(std::isnan(v) ? 0.0 : v);
+   }
+   inputs[5].push_back(std::numeric_limits<double>::quiet_NaN());
+   inputs[5].push_back(-0.0);
+   inputs[5].push_back(std::numeric_limits<double>::infinity());
+   inputs[5].push_back(std::numeric_limits<double>::denorm_min());
+   inputs[5].push_back(-std::numeric_limits<double>::max());
+
+   for (unsigned int d = 0; d < inputs.size(); d++) {
+      for (unsigned int f = 0; f < 3; f++) {
+         for (unsigned int c = 0; c < codecs.size(); c++) {
+            for (unsigned int l = 0; l < 4; l++) {
+               Compress::Method method =
+                  Compress::from_string(filters[f], codecs[c], levels[l]);
+               const std::vector<double> &in = inputs[d];
+               std::vector<char> packed =
+                  Compress::compress(in.data(), in.size(), method);
+               std::vector<double> out(in.size());
+               Compress::decompress(packed.data(), packed.size(), method,
+                     out.data(), out.size());
+               if (!same_bits(in, out)) {
+                  std::cout << "input " << d << " with ";
+                  std::cout << Compress::to_string(method);
+                  std::cout << " did not come back" << std::endl;
+                  errors++;
+               }
+               // Damaged data must not decompress quietly into garbage
+               if ((packed.size() > 1) &&
+                     (method.codec != Compress::NO_CODEC)) {
+                  packed.resize(packed.size() - 1);
+                  try {
+                     Compress::decompress(packed.data(), packed.size(),
+                           method, out.data(), out.size());
+                     std::cout << "input " << d << " with ";
+                     std::cout << Compress::to_string(method);
+                     std::cout << ": short data not detected" << std::endl;
+                     errors++;
+                  } catch (std::runtime_error &) {
+                  }
+               }
+            }
+         }
+      }
+   }
+
+   // Quantized values must stay within the bound (and values that are not
+   // finite must come back exactly)
+   const double bounds[] = {1e-12, 1e-6, 0.01, 1e300};
+   for (unsigned int d = 0; d < inputs.size(); d++) {
+      for (unsigned int c = 0; c < codecs.size(); c++) {
+         for (unsigned int b = 0; b < 4; b++) {
+            for (int level = 0; level <= 6; level += 6) {
+               Compress::Method method =
+                  Compress::quantize(bounds[b], codecs[c], level);
+               const std::vector<double> &in = inputs[d];
+               std::vector<char> packed =
+                  Compress::compress(in.data(), in.size(), method);
+               std::vector<double> out(in.size());
+               Compress::decompress(packed.data(), packed.size(), method,
+                     out.data(), out.size());
+               for (unsigned int i = 0; i < in.size(); i++) {
+                  bool ok = std::isfinite(in[i]) ?
+                     (std::fabs(out[i] - in[i]) <= bounds[b]) :
+                     (std::memcmp(&out[i], &in[i], sizeof(double)) == 0);
+                  if (!ok) {
+                     std::cout << "input " << d << " with ";
+                     std::cout << Compress::to_string(method);
+                     std::cout << ": value " << i << " is off" << std::endl;
+                     errors++;
+                     break;
+                  }
+               }
+            }
+         }
+      }
+   }
+
+   // A loose bound on a smooth field should beat lossless compression by far
+   const std::vector<double> &smooth = inputs[2];
+   std::vector<char> lossless = Compress::compress(smooth.data(),
+         smooth.size(), Compress::from_string("xor", "lz", 6));
+   std::vector<char> lossy = Compress::compress(smooth.data(), smooth.size(),
+         Compress::quantize(1e-4, "lz", 6));
+   if (lossy.size() * 5 > lossless.size()) {
+      std::cout << "quantized smooth field took " << lossy.size();
+      std::cout << " bytes (lossless " << lossless.size() << ")" << std::endl;
+      errors++;
+   }
+
+   // Smooth data should shrink a lot
+   Compress::Method method = Compress::from_string("xor", "lz", 6);
+   std::vector<char> packed =
+      Compress::compress(inputs[3].data(), inputs[3].size(), method);
+   if (packed.size() * 20 > inputs[3].size() * sizeof(double)) {
+      std::cout << "step function only compressed to " << packed.size();
+      std::cout << " bytes" << std::endl;
+      errors++;
+   }
+
+   if (errors > 0) {
+      std::cout << errors << " errors" << std::endl;
+      return 1;
+   }
+   std::cout << "compress: all checks passed" << std::endl;
+   return 0;
+}
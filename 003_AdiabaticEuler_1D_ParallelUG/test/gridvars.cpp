@@ -0,0 +1,94 @@
+#include <iostream>
+#include <vector>
+#include "Grid.hpp"
+
+// The Grid component normally owns these; define them here so that the grid
+// variables can be tested on their own.
+namespace Grid {
+   DelayedConst<unsigned int> Ng, Nx_local, n_vars;
+   DelayedConst<int> ilo, ihi;
+   DelayedConst<Layout> layout;
+   DelayedConst<unsigned int> tile_width;
+}
+
+// Fill every (i,v) with a unique value, then read them all back.  Any overlap
+// in the layout's offset function shows up as a mismatch.  The per-variable
+// views must refer to the same elements as (i,v).
+template <class Var>
+int check (Var &var, int lo, int hi, unsigned int nv, std::string name) {
+   int errors = 0;
+   for (int i = lo; i < hi; i++) {
+      for (unsigned int v = 0; v < nv; v++) {
+         var(i,v) = 1000.0*i + v;
+      }
+   }
+   for (int i = lo; i < hi; i++) {
+      for (unsigned int v = 0; v < nv; v++) {
+         if (var(i,v) != 1000.0*i + v) {
+            errors++;
+         }
+      }
+   }
+   for (unsigned int v = 0; v < nv; v++) {
+      Grid::VarView view = var.view(v);
+      for (int i = lo; i < hi; i++) {
+         if (&view[i] != &var(i,v)) {
+            errors++;
+         }
+      }
+   }
+   try {
+      var(hi,0);
+      errors++;
+   } catch (std::out_of_range &e) {
+   }
+   std::cout << "  " << name << ": " << errors << " errors" << std::endl;
+   return errors;
+}
+
+int main (int argc, char *argv[]) {
+
+   int errors = 0;
+   const unsigned int nv = 5;
+
+   Grid::Ng = 2;
+   Grid::Nx_local = 13;
+   Grid::ilo = -2;
+   Grid::ihi = 15;
+
+   std::cout << "layouts:" << std::endl;
+   {
+      Grid::CellVar c;
+      Grid::FaceVar f;
+      c.init(nv, Grid::AOS);
+      f.init(nv, Grid::AOS);
+      errors += check(c, Grid::ilo, Grid::ihi,   nv, "CellVar aos        ");
+      errors += check(f, Grid::ilo, Grid::ihi-1, nv, "FaceVar aos        ");
+   }
+   {
+      Grid::CellVar c;
+      Grid::FaceVar f;
+      c.init(nv, Grid::SOA);
+      f.init(nv, Grid::SOA);
+      errors += check(c, Grid::ilo, Grid::ihi,   nv, "CellVar soa        ");
+      errors += check(f, Grid::ilo, Grid::ihi-1, nv, "FaceVar soa        ");
+   }
+   {
+      Grid::CellVar c;
+      Grid::FaceVar f;
+      c.init(nv, Grid::AOSOA, 4);
+      f.init(nv, Grid::AOSOA, 4);
+      errors += check(c, Grid::ilo, Grid::ihi,   nv, "CellVar aosoa (T=4)");
+      errors += check(f, Grid::ilo, Grid::ihi-1, nv, "FaceVar aosoa (T=4)");
+   }
+   {
+      // Re-initializing with a different layout reallocates
+      Grid::CellVar c;
+      c.init(nv, Grid::AOS);
+      c.init(nv, Grid::AOSOA, 3);
+      errors += check(c, Grid::ilo, Grid::ihi,   nv, "CellVar aos->aosoa ");
+   }
+
+   std::cout << "total errors: " << errors << std::endl;
+   return (errors == 0) ? 0 : 1;
+}
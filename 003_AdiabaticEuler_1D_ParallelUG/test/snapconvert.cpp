@@ -0,0 +1,132 @@
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <boost/filesystem.hpp>
+#include "Snapshot.hpp"
+
+// Convert step directories to snapshots with snapconvert and check that the
+// snapshot holds each cell once, as the index gives them: a directory reused
+// by a run on fewer processors (with a data file of the earlier run still
+// in it), and a directory of aggregated output (several processors' cells in
+// each node file).
+//
+// Usage: snapconvert_test [path of snapconvert]
+
+namespace fs = boost::filesystem;
+
+const unsigned int n_cells = 6;
+
+double position (unsigned int i) {
+   return i + 0.5;
+}
+
+double density (unsigned int i) {
+   return 10.0 + 0.25 * i;
+}
+
+// The rows of cells first to last-1
+std::string rows (unsigned int first, unsigned int last, double shift) {
+   std::ostringstream out;
+   for (unsigned int i = first; i < last; i++) {
+      out << position(i) + shift << "   " << density(i) + shift << "\n";
+   }
+   return out.str();
+}
+
+// A data file holding the given rows, and an index line for the cells
+// first to last-1 (which start offset bytes into the file's data lines)
+const std::string names = "# position\n# density\n";
+
+void write_file (const std::string &filename, const std::string &data) {
+   std::ofstream fout(filename.c_str());
+   fout << names << data;
+}
+
+std::string index_line (const std::string &file, unsigned int first,
+      unsigned int last, std::size_t offset) {
+   std::ostringstream out;
+   out << file << "   " << first << "   " << last - first << "   ";
+   out << names.size() + offset << "   0\n";
+   return out.str();
+}
+
+void write_step (const std::string &dirname, const std::string &index) {
+   std::ofstream fout((fs::path(dirname) / "header.txt").string().c_str());
+   fout << "time        = 0.5\nstep        = 7\n";
+   fout.close();
+   fout.open((fs::path(dirname) / "index.txt").string().c_str());
+   fout << "# file   first_cell   n_cells   data_offset   line_bytes\n";
+   fout << index;
+}
+
+// Convert dirname and check the snapshot
+int check (const std::string &snapconvert, const std::string &dirname) {
+
+   const std::string filename = dirname + ".snap";
+   const std::string command = snapconvert + " " + dirname + " " +
+      filename + " > /dev/null";
+   int errors = 0;
+
+   if (std::system(command.c_str()) != 0) {
+      std::cout << dirname << ": snapconvert failed" << std::endl;
+      return 1;
+   }
+   Snapshot::File file(filename);
+   const Snapshot::Info &info = file.info();
+   if ((info.n_cells != n_cells) || (info.step != 7) || (info.time != 0.5) ||
+         (info.names.size() != 2)) {
+      std::cout << dirname << ": wrong header (" << info.n_cells;
+      std::cout << " cells)" << std::endl;
+      return 1;
+   }
+   for (unsigned int i = 0; i < n_cells; i++) {
+      if ((file.array(0)[i] != position(i)) ||
+            (file.array(1)[i] != density(i))) {
+         std::cout << dirname << ": wrong values for cell " << i << std::endl;
+         errors++;
+      }
+   }
+   std::remove(filename.c_str());
+   return errors;
+}
+
+int main (int argc, char *argv[]) {
+
+   const std::string snapconvert = (argc > 1) ? argv[1] : "./snapconvert";
+   const std::string reused = "/tmp/toy_hydro_test_reused";
+   const std::string aggregated = "/tmp/toy_hydro_test_aggregated";
+   int errors = 0;
+
+   // Written by two processors into a directory that three had written to
+   fs::remove_all(reused);
+   fs::create_directories(reused);
+   write_file(reused + "/grid_000000.dat", rows(0, 3, 0.0));
+   write_file(reused + "/grid_000001.dat", rows(3, 6, 0.0));
+   write_file(reused + "/grid_000002.dat", rows(4, 6, 100.0));
+   write_step(reused, index_line("grid_000000.dat", 0, 3, 0) +
+         index_line("grid_000001.dat", 3, 6, 0));
+   errors += check(snapconvert, reused);
+
+   // Three processors in two aggregation groups
+   fs::remove_all(aggregated);
+   fs::create_directories(aggregated);
+   write_file(aggregated + "/node_000000.dat", rows(0, 4, 0.0));
+   write_file(aggregated + "/node_000001.dat", rows(4, 6, 0.0));
+   write_step(aggregated, index_line("node_000000.dat", 0, 2, 0) +
+         index_line("node_000000.dat", 2, 4, rows(0, 2, 0.0).size()) +
+         index_line("node_000001.dat", 4, 6, 0));
+   errors += check(snapconvert, aggregated);
+
+   fs::remove_all(reused);
+   fs::remove_all(aggregated);
+
+   if (errors > 0) {
+      std::cout << errors << " errors" << std::endl;
+      return 1;
+   }
+   std::cout << "snapconvert: all checks passed" << std::endl;
+   return 0;
+}
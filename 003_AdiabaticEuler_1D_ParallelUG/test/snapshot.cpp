@@ -0,0 +1,205 @@
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+#include "Snapshot.hpp"
+
+// Write a snapshot, map it back, and check that every array is aligned and
+// holds exactly what was written (or, when compressed, that it decompresses
+// to exactly that, in whole and in part).  Then damage the file in a few
+// ways and check that reading it fails.  Also check that the header and
+// tables of a delta read back as written, and that damage to them is found.
+
+int check (unsigned int n, bool compressed) {
+
+   const std::string filename = "/tmp/toy_hydro_test.snap";
+   const unsigned int n_arrays = 3;
+   int errors = 0;
+
+   Snapshot::Info info;
+   info.time = 0.125;
+   info.step = 42;
+   info.n_cells = n;
+   info.xmin = -1.0;
+   info.xmax = 1.0;
+   info.names.push_back("position");
+   info.names.push_back("density");
+   info.names.push_back("a_name_of_31_chars_is_the_limit");
+   if (compressed) {
+      info.methods.push_back(Compress::from_string("xor", "lz", 6));
+      info.methods.push_back(Compress::from_string("shuffle", "auto", 1));
+      info.methods.push_back(Compress::none);
+   }
+
+   std::vector< std::vector<double> > values(n_arrays, std::vector<double>(n));
+   std::vector<const double *> arrays;
+   for (unsigned int a = 0; a < n_arrays; a++) {
+      for (unsigned int i = 0; i < n; i++) {
+         values[a][i] = 1.0 / (3.0 + i) + a;
+      }
+      arrays.push_back(&values[a][0]);
+   }
+   Snapshot::write(filename, info, arrays);
+
+   {
+      Snapshot::File file(filename);
+      const Snapshot::Info &read = file.info();
+      if ((read.time != info.time) || (read.step != info.step) ||
+            (read.n_cells != n) || (read.xmin != info.xmin) ||
+            (read.xmax != info.xmax) || (read.names != info.names)) {
+         std::cout << "header does not match" << std::endl;
+         errors++;
+      }
+      for (unsigned int a = 0; a < n_arrays && !compressed; a++) {
+         const double *p = file.array(info.names[a]);
+         if (std::uintptr_t(p) % Snapshot::alignment != 0) {
+            std::cout << "array " << a << " is not aligned" << std::endl;
+            errors++;
+         }
+         for (unsigned int i = 0; i < n; i++) {
+            if (p[i] != values[a][i]) {
+               errors++;
+            }
+         }
+      }
+      // The whole array, then a part of it
+      for (unsigned int a = 0; a < n_arrays; a++) {
+         std::vector<double> out(n + n/3);
+         file.read(a, 0, n, out.data());
+         file.read(a, n/3, n/3, out.data() + n);
+         for (unsigned int i = 0; i < n; i++) {
+            if (out[i] != values[a][i]) {
+               errors++;
+            }
+         }
+         for (unsigned int i = 0; i < n/3; i++) {
+            if (out[n+i] != values[a][n/3+i]) {
+               errors++;
+            }
+         }
+      }
+      try {
+         file.array("missing");
+         std::cout << "missing array not detected" << std::endl;
+         errors++;
+      } catch (std::out_of_range &) {
+      }
+   }
+
+   // Damaged files: wrong magic, wrong byte order, cut short
+   const long damage[3] = {0, 12, -1};
+   for (unsigned int d = 0; d < 3; d++) {
+      Snapshot::write(filename, info, arrays);
+      if (damage[d] >= 0) {
+         std::fstream f(filename.c_str(),
+               std::ios::in | std::ios::out | std::ios::binary);
+         f.seekp(damage[d]);
+         f.put('X');
+      } else {
+         std::vector<char> bytes(Snapshot::file_size(info) / 2);
+         std::ifstream fin(filename.c_str(), std::ios::binary);
+         fin.read(&bytes[0], bytes.size());
+         fin.close();
+         std::ofstream fout(filename.c_str(), std::ios::binary);
+         fout.write(&bytes[0], bytes.size());
+      }
+      try {
+         Snapshot::File file(filename);
+         std::cout << "damaged file " << d << " not detected" << std::endl;
+         errors++;
+      } catch (std::ios_base::failure &) {
+      }
+   }
+
+   std::remove(filename.c_str());
+   return errors;
+}
+
+int check_delta () {
+
+   int errors = 0;
+
+   Snapshot::DeltaInfo info;
+   info.time = 0.5;
+   info.step = 300;
+   info.n_cells = 1000;
+   info.base_step = 200;
+   info.full_step = 100;
+   info.block_size = 64;
+   info.names.push_back("density");
+   info.names.push_back("energy");
+   info.grid_checksum = 12345;
+   const unsigned long blocks[4] = {0, 3, 4, 15};   // 15 is short
+   for (unsigned int k = 0; k < 4; k++) {
+      info.blocks.push_back(blocks[k]);
+      info.checksums.push_back(Snapshot::cell_checksum(k, 0, 1.0 / (k + 1)));
+   }
+   std::vector<char> bytes = Snapshot::encode_delta(info);
+
+   Snapshot::DeltaInfo read = Snapshot::decode_delta(&bytes[0], bytes.size());
+   if ((read.time != info.time) || (read.step != info.step) ||
+         (read.n_cells != info.n_cells) || (read.base_step != 200) ||
+         (read.full_step != 100) || (read.block_size != 64) ||
+         (read.names != info.names) || (read.blocks != info.blocks) ||
+         (read.checksums != info.checksums) ||
+         (read.grid_checksum != info.grid_checksum)) {
+      std::cout << "delta header does not match" << std::endl;
+      errors++;
+   }
+   // 3*64 + 40 cells are stored; each array starts aligned
+   const std::size_t stride = 232 * sizeof(double);
+   if ((read.stored_before.back() != 232) ||
+         (read.offset(1, 2) != read.data_offset + stride +
+          2 * 64 * sizeof(double)) ||
+         (read.offset(0, 0) % Snapshot::alignment != 0) ||
+         (Snapshot::delta_file_size(read) != read.data_offset + 2 * stride)) {
+      std::cout << "delta layout is wrong" << std::endl;
+      errors++;
+   }
+   if (!Snapshot::is_delta(&bytes[0], bytes.size()) ||
+         (Snapshot::delta_header_size(&bytes[0], bytes.size()) !=
+          bytes.size())) {
+      std::cout << "delta not recognized" << std::endl;
+      errors++;
+   }
+
+   // Damaged tables, and blocks out of order
+   const std::size_t damage[2] = {sizeof(Snapshot::DeltaHeader) + 1,
+      sizeof(Snapshot::DeltaHeader) + 64 + 16};
+   for (unsigned int d = 0; d < 2; d++) {
+      std::vector<char> damaged = bytes;
+      damaged[damage[d]] ^= 1;
+      try {
+         Snapshot::decode_delta(&damaged[0], damaged.size());
+         std::cout << "damaged delta " << d << " not detected" << std::endl;
+         errors++;
+      } catch (std::ios_base::failure &) {
+      }
+   }
+   std::swap(info.blocks[1], info.blocks[2]);
+   try {
+      Snapshot::encode_delta(info);
+      std::cout << "blocks out of order not detected" << std::endl;
+      errors++;
+   } catch (std::invalid_argument &) {
+   }
+
+   return errors;
+}
+
+int main () {
+
+   // 1000 doubles end on an alignment boundary, 1001 do not
+   int errors = check(1000, false) + check(1001, false) +
+      check(1000, true) + check(1001, true) + check_delta();
+
+   if (errors > 0) {
+      std::cout << errors << " errors" << std::endl;
+      return 1;
+   }
+   std::cout << "snapshot: all checks passed" << std::endl;
+   return 0;
+}
@@ -0,0 +1,94 @@
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "TextFormat.hpp"
+
+// Check that the fast formatter prints exactly what the stream formatting
+// of the text output prints, for ordinary and odd values (NaNs, infinities,
+// signed zeros, the smallest and largest values) and for random bit patterns.
+
+// The text output as Grid::write_data used to print it
+std::string stream_rows (const std::vector< std::vector<double> > &columns) {
+   const unsigned int w = TextFormat::width;
+   std::ostringstream out;
+   out.precision(w-8);
+   out.setf(std::ios::scientific);
+   for (unsigned int i = 0; i < columns[0].size(); i++) {
+      out << std::setw(w) << columns[0][i];
+      for (unsigned int c = 1; c < columns.size(); c++) {
+         out << "   " << std::setw(w) << columns[c][i];
+      }
+      out << std::endl;
+   }
+   return out.str();
+}
+
+std::string fast_rows (const std::vector< std::vector<double> > &columns) {
+   const unsigned int n = columns[0].size();
+   std::vector<const double *> pointers;
+   for (unsigned int c = 0; c < columns.size(); c++) {
+      pointers.push_back(columns[c].data());
+   }
+   std::vector<char> buffer(n * TextFormat::max_row_bytes(columns.size()));
+   char *end = TextFormat::format_rows(buffer.data(), pointers.data(),
+         columns.size(), 0, n);
+   return std::string(buffer.data(), end);
+}
+
+int main () {
+
+   typedef std::numeric_limits<double> limits;
+   std::vector< std::vector<double> > columns(3);
+   std::uint64_t state = 987654321;
+   int errors = 0;
+
+   // Odd values
+   const double odd[] = {0.0, -0.0, 1.0, -1.0, 0.1, 1e-300, 1e300, 9.5e99,
+      9.9999999999999999e99, limits::max(), -limits::max(), limits::min(),
+      limits::denorm_min(), -limits::denorm_min(), limits::infinity(),
+      -limits::infinity(), limits::quiet_NaN(), -limits::quiet_NaN(),
+      -2.4950000000000000000000e+02, 1.0493385229870771269134e+01};
+   for (unsigned int i = 0; i < sizeof(odd) / sizeof(odd[0]); i++) {
+      for (unsigned int c = 0; c < columns.size(); c++) {
+         columns[c].push_back(odd[(i + c) % (sizeof(odd) / sizeof(odd[0]))]);
+      }
+   }
+
+   // Random bit patterns (every exponent), and values like the grid's
+   for (int i = 0; i < 100000; i++) {
+      state = state * 6364136223846793005ull + 1442695040888963407ull;
+      double v;
+      std::memcpy(&v, &state, sizeof(v));
+      columns[0].push_back(v);
+      columns[1].push_back(10.0 + (state >> 11) * 0x1.0p-53);
+      columns[2].push_back(-250.0 + 0.5 * i);
+   }
+
+   const std::string expected = stream_rows(columns);
+   const std::string actual = fast_rows(columns);
+   if (actual != expected) {
+      std::size_t i = 0;
+      while ((i < actual.size()) && (actual[i] == expected[i])) {
+         i++;
+      }
+      const std::size_t line = expected.rfind('\n', i) + 1;
+      std::cout << "mismatch at byte " << i << ":" << std::endl;
+      std::cout << expected.substr(line, expected.find('\n', i) - line);
+      std::cout << std::endl;
+      std::cout << actual.substr(line, actual.find('\n', i) - line);
+      std::cout << std::endl;
+      errors++;
+   }
+
+   if (errors > 0) {
+      std::cout << errors << " errors" << std::endl;
+      return 1;
+   }
+   std::cout << "textformat: all checks passed" << std::endl;
+   return 0;
+}
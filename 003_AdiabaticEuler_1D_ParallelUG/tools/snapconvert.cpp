@@ -0,0 +1,266 @@
+#include <algorithm>
+#include <cstdlib>
+#include <exception>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+#include <boost/filesystem.hpp>
+#include "Snapshot.hpp"
+
+// Convert between binary snapshots (see Snapshot.hpp) and the text output.
+//
+// Usage: snapconvert <input> <output>
+//
+// - If the input is a snapshot (*.snap), the output is a step directory like
+//   the ones Grid::write_data makes (header.txt and grid.dat).
+// - Otherwise the input is a step directory or a single data file, and the
+//   output is a snapshot.  The cells of a step directory are read from the
+//   files its index (index.txt) lists, at the places it gives, so files of
+//   an earlier output into the same directory are ignored and aggregated
+//   output (node_NNNNNN.dat) works.  A directory without an index (older
+//   output) holds grid.dat or the grid_NNNNNN.dat files of a parallel run,
+//   joined in processor order.
+// Data files without "# name" comments (such as the ones from the old Python
+// version) get the array names position, var1, var2, ...  The grid limits are
+// taken from the positions, assuming equal cell sizes.
+
+namespace fs = boost::filesystem;
+
+typedef std::vector< std::vector<double> > Columns;
+
+// Cells of a data file: count cells from the line starting at offset, or
+// (with count = all_cells) every cell in the file
+const unsigned long all_cells = -1;
+
+struct Part {
+   std::string file;
+   unsigned long count;
+   unsigned long offset;
+};
+
+// The parts of a step directory listed in its index (none if it has no
+// index), which must hold every cell once, in order
+std::vector<Part> read_index (const std::string &dirname) {
+
+   std::ifstream fin((fs::path(dirname) / "index.txt").string().c_str());
+   std::string line;
+   std::vector<Part> parts;
+   unsigned long next = 0, first;
+
+   while (std::getline(fin, line)) {
+      if (line.find('#') != std::string::npos) {
+         continue;
+      }
+      std::istringstream iss(line);
+      Part part;
+      if (iss >> part.file >> first >> part.count >> part.offset) {
+         if (first != next) {
+            throw std::length_error("index.txt in " + dirname +
+                  " does not list every cell once, in order");
+         }
+         part.file = (fs::path(dirname) / part.file).string();
+         parts.push_back(part);
+         next += part.count;
+      }
+   }
+   return parts;
+}
+
+// Read part of one data file, appending its rows to the columns
+void read_text (const Part &part, std::vector<std::string> &names,
+      Columns &columns) {
+
+   const std::string &filename = part.file;
+   std::ifstream fin(filename.c_str());
+   std::string line;
+   std::vector<std::string> file_names;
+   unsigned long n_rows = 0;
+   double value;
+
+   if (!fin) {
+      throw std::ios_base::failure("could not open " + filename);
+   }
+   // The names, in comment lines at the top
+   while (fin.peek() == '#') {
+      std::getline(fin, line);
+      file_names.push_back(line.substr(line.find_first_not_of("# ")));
+   }
+   if (part.offset > 0) {
+      fin.seekg(part.offset);
+   }
+   while ((n_rows < part.count) && std::getline(fin, line)) {
+      if (line.empty() || (line[0] == '#')) {
+         continue;
+      }
+      std::istringstream iss(line);
+      std::vector<double> row;
+      while (iss >> value) {
+         row.push_back(value);
+      }
+      if (columns.empty()) {
+         columns.resize(row.size());
+      }
+      if (row.size() != columns.size()) {
+         throw std::length_error("wrong number of values in " + filename);
+      }
+      for (unsigned int c = 0; c < row.size(); c++) {
+         columns[c].push_back(row[c]);
+      }
+      n_rows++;
+   }
+   if ((part.count != all_cells) && (n_rows < part.count)) {
+      throw std::length_error(filename + " is too short for its index");
+   }
+
+   if (file_names.empty()) {
+      file_names.push_back("position");
+      for (unsigned int c = 1; c < columns.size(); c++) {
+         std::stringstream ss;
+         ss << "var" << c;
+         file_names.push_back(ss.str());
+      }
+   }
+   if (names.empty()) {
+      names = file_names;
+   } else if (names != file_names) {
+      throw std::invalid_argument("data files have different variables");
+   }
+}
+
+// Text (directory or file) to snapshot
+void text_to_snapshot (const std::string &input, const std::string &output) {
+
+   Snapshot::Info info;
+   Columns columns;
+   std::vector<Part> parts;
+   std::vector<const double *> arrays;
+   std::string line;
+
+   info.time = 0.0;
+   info.step = 0;
+
+   if (fs::is_directory(input)) {
+      // The data files, from the index or else in processor order
+      parts = read_index(input);
+      if (parts.empty()) {
+         std::vector< std::pair<int, std::string> > numbered;
+         fs::directory_iterator end;
+         for (fs::directory_iterator iter(input); iter != end; iter++) {
+            std::string name = iter->path().filename().string();
+            if (name == "grid.dat") {
+               numbered.push_back(std::make_pair(-1, iter->path().string()));
+            } else if ((name.substr(0,5) == "grid_") &&
+                  (iter->path().extension() == ".dat")) {
+               numbered.push_back(std::make_pair(
+                        std::atoi(name.substr(5).c_str()),
+                        iter->path().string()));
+            }
+         }
+         std::sort(numbered.begin(), numbered.end());
+         for (unsigned int f = 0; f < numbered.size(); f++) {
+            Part part = {numbered[f].second, all_cells, 0};
+            parts.push_back(part);
+         }
+      }
+
+      // The time and step, if there is a header
+      std::ifstream fin((fs::path(input) / "header.txt").string().c_str());
+      while (std::getline(fin, line)) {
+         std::string key = line.substr(0, line.find("="));
+         std::istringstream iss(line.substr(line.find("=") + 1));
+         if (key.find("time") != std::string::npos) {
+            iss >> info.time;
+         } else if (key.find("step") != std::string::npos) {
+            iss >> info.step;
+         }
+      }
+   } else {
+      Part part = {input, all_cells, 0};
+      parts.push_back(part);
+   }
+   if (parts.empty()) {
+      throw std::ios_base::failure("no data files in " + input);
+   }
+
+   for (unsigned int f = 0; f < parts.size(); f++) {
+      read_text(parts[f], info.names, columns);
+   }
+   if (columns.empty() || columns[0].empty()) {
+      throw std::length_error("no data in " + input);
+   }
+
+   const std::vector<double> &x = columns[0];
+   const std::size_t n = x.size();
+   const double dx = (n > 1) ? (x[n-1] - x[0]) / (n - 1) : 0.0;
+   info.n_cells = n;
+   info.xmin = x[0] - 0.5 * dx;
+   info.xmax = x[n-1] + 0.5 * dx;
+   for (unsigned int c = 0; c < columns.size(); c++) {
+      arrays.push_back(&columns[c][0]);
+   }
+   Snapshot::write(output, info, arrays);
+
+   std::cout << output << ": " << n << " cells, " << columns.size();
+   std::cout << " arrays" << std::endl;
+}
+
+// Snapshot to text, in the format of Grid::write_data
+void snapshot_to_text (const std::string &input, const std::string &output) {
+
+   const unsigned int w = 30;
+   Snapshot::File file(input);
+   const Snapshot::Info &info = file.info();
+   std::vector< std::vector<double> > arrays(info.names.size());
+   std::ofstream fout;
+
+   fs::create_directories(output);
+
+   fout.open((fs::path(output) / "header.txt").string().c_str());
+   fout << "time        = " << info.time << std::endl;
+   fout << "step        = " << info.step << std::endl;
+   fout.close();
+
+   fout.open((fs::path(output) / "grid.dat").string().c_str());
+   for (unsigned int a = 0; a < info.names.size(); a++) {
+      fout << "# " << info.names[a] << std::endl;
+      arrays[a].resize(info.n_cells);
+      file.read(a, 0, info.n_cells, arrays[a].data());
+   }
+   fout.precision(w-8);
+   fout.setf(std::ios::scientific);
+   for (unsigned long i = 0; i < info.n_cells; i++) {
+      for (unsigned int a = 0; a < arrays.size(); a++) {
+         fout << ((a > 0) ? "   " : "") << std::setw(w) << arrays[a][i];
+      }
+      fout << std::endl;
+   }
+   fout.close();
+
+   std::cout << output << ": " << info.n_cells << " cells, ";
+   std::cout << info.names.size() << " arrays" << std::endl;
+}
+
+int main (int argc, char *argv[]) {
+
+   if (argc != 3) {
+      std::cerr << "Usage: snapconvert <input> <output>" << std::endl;
+      return 1;
+   }
+
+   try {
+      if (fs::path(argv[1]).extension() == ".snap") {
+         snapshot_to_text(argv[1], argv[2]);
+      } else {
+         text_to_snapshot(argv[1], argv[2]);
+      }
+   } catch (std::exception &e) {
+      std::cerr << "snapconvert: " << e.what() << std::endl;
+      return 1;
+   }
+
+   return 0;
+}